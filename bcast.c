@@ -0,0 +1,120 @@
+/**
+ * This program benchmarks MPI_Bcast for various message sizes. Every
+ * processor times the broadcasts it takes part in and root prints the
+ * min, avg and max time per broadcast of the slowest processor.
+ */
+#include "mympi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_BCAST_ITR 8
+#define MSG_START_EXP  3
+#define MSG_END_EXP 22
+
+/*Broadcast bytes depend on their offset, so that misplaced segments are
+ *caught as well, the period is prime to miss every power of two*/
+#define FILL_PERIOD 251
+
+int main(int argc, char *argv[])
+{
+    int nr_nodes, rank;
+
+    int msg_init_size = 1 << MSG_START_EXP;	//message intial size 8 bytes
+    int msg_last_size = 1 << MSG_END_EXP;	//message final size
+    int curr_msg_size;
+
+    //Initialize
+    MPI_Init(&argc, &argv);
+
+    //retrieve nr_process and current process rank
+    MPI_Comm_size(MPI_COMM_WORLD, &nr_nodes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    char *buffer = (char *) malloc(sizeof(char) * msg_last_size);
+    char *expected = (char *) malloc(sizeof(char) * msg_last_size);
+    if (!buffer || !expected) {
+	perror("Failed to allocate broadcast buffer");
+	goto fail;
+    }
+    double *all_stats = (double *) malloc(sizeof(double) * 3 * nr_nodes);
+    if (!all_stats) {
+	perror("Failed to allocate statistics buffer");
+	goto fail;
+    }
+
+    for (curr_msg_size = msg_init_size; curr_msg_size <= msg_last_size;
+	 curr_msg_size *= 2) {
+	double min_time = 99999, cum_time = 0, max_time = 0;
+	double start_time, bcast_time;
+	int i;
+	int j;
+
+	for (i = 0; i < NR_BCAST_ITR; i++) {
+	    for (j = 0; j < curr_msg_size; j++) {
+		expected[j] = (char) (j % FILL_PERIOD + i + 1);
+	    }
+	    if (rank == 0) {
+		memcpy(buffer, expected, curr_msg_size);
+	    } else {
+		memset(buffer, 0, curr_msg_size);
+	    }
+
+	    start_time = MPI_Wtime();
+	    if (MPI_Bcast(buffer, curr_msg_size, MPI_CHAR, 0,
+			  MPI_COMM_WORLD) != MPI_SUCCESS) {
+		fprintf(stderr, "Failed to broadcast message of size %d\n",
+			curr_msg_size);
+		goto fail;
+	    }
+	    bcast_time = MPI_Wtime() - start_time;
+
+	    //validate every byte of received message
+	    if (memcmp(buffer, expected, curr_msg_size) != 0) {
+		fprintf(stderr, "Corrupt broadcast of size %d on %d\n",
+			curr_msg_size, rank);
+		goto fail;
+	    }
+	    //first broadcast warms up connections
+	    if (i != 0) {
+		if (min_time > bcast_time) {
+		    min_time = bcast_time;
+		}
+		if (max_time < bcast_time) {
+		    max_time = bcast_time;
+		}
+		cum_time = cum_time + bcast_time;
+	    }
+	}
+
+	//collect statistics of the slowest processor at root
+	double stats[3] = { min_time, cum_time / (NR_BCAST_ITR - 1),
+	    max_time
+	};
+	if (MPI_Gather(stats, 3, MPI_DOUBLE, all_stats, 3, MPI_DOUBLE, 0,
+		       MPI_COMM_WORLD) != MPI_SUCCESS) {
+	    fprintf(stderr, "Failed to gather statistics\n");
+	    goto fail;
+	}
+	if (rank == 0) {
+	    int node;
+	    for (node = 1; node < nr_nodes; node++) {
+		if (all_stats[node * 3 + 1] > stats[1]) {
+		    memcpy(stats, &all_stats[node * 3], sizeof(stats));
+		}
+	    }
+	    fprintf(stderr, "%-7d %e %e %e\n", curr_msg_size, stats[0],
+		    stats[1], stats[2]);
+	}
+    }
+
+    free(all_stats);
+    free(expected);
+    free(buffer);
+    MPI_Finalize();
+    return 0;
+
+  fail:
+    MPI_Finalize();
+    return -1;
+}
@@ -0,0 +1,394 @@
+/**
+ * This program starts an MPI job on the local host.
+ *
+ *     mpirun [-n nprocs] [-b] [-p port] program [arguments...]
+ *
+ * Every pair of processors is connected through a socketpair before any of
+ * them starts, and each one finds its rank, the job size and its end of
+ * every pair in MYMPI_RANK, MYMPI_SIZE and MYMPI_FDS, so MPI_Init neither
+ * listens nor connects. With -p the processors bootstrap over TCP instead,
+ * root listening on port, which keeps shared memory channels and striping
+ * available; the usual five arguments are then appended to the program's.
+ * With -b processor i is pinned to the i-th CPU it may run on, wrapping
+ * around. Output of the processors is forwarded line by line and a
+ * processor which fails brings the whole job down.
+ */
+#define _GNU_SOURCE
+#include "mympi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+/*Define boolean values*/
+#define FALSE              0
+#define TRUE               1
+
+/*Processors started when -n is not given*/
+#define DEFAULT_NR_PROCS   2
+
+/*Output kept per stream till a line is complete*/
+#define LINE_BUFFER_SIZE   4096
+
+/*How often exits are looked for while waiting for output, in ms*/
+#define REAP_INTERVAL      100
+
+/*Output stream of a processor*/
+struct output {
+    int fd;			/*read end of the pipe or -1 once closed */
+    int out;			/*descriptor forwarded to */
+    unsigned int len;		/*bytes buffered */
+    char buff[LINE_BUFFER_SIZE];
+};
+
+/*Processor of the job*/
+struct proc {
+    pid_t pid;			/*0 once reaped */
+    struct output output[2];	/*stdout and stderr */
+};
+
+static void __usage(char *name)
+{
+    fprintf(stderr, "usage: %s [-n nprocs] [-b] [-p port] program "
+	    "[arguments...]\n", name);
+}
+
+/*
+ * Raises the descriptor limit as far as allowed, the launcher holds both
+ * ends of every pair till the processors are started.
+ */
+static void __raise_fd_limit(int nr_procs)
+{
+    struct rlimit limit;
+    rlim_t needed = (rlim_t) nr_procs * nr_procs + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+	limit.rlim_cur = limit.rlim_max < needed ? limit.rlim_max : needed;
+	setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/*
+ * Connects every pair of processors, ends[i * nr_procs + j] is the end
+ * processor i talks to processor j through. Descriptors are closed on exec
+ * so each processor only keeps its own.
+ */
+static int __connect_pairs(int nr_procs, int *ends)
+{
+    int pair[2];
+    int i;
+    int j;
+
+    for (i = 0; i < nr_procs; i++) {
+	ends[i * nr_procs + i] = -1;
+	for (j = i + 1; j < nr_procs; j++) {
+	    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+		perror("socketpair");
+		return -1;
+	    }
+	    ends[i * nr_procs + j] = pair[0];
+	    ends[j * nr_procs + i] = pair[1];
+	}
+    }
+    return 0;
+}
+
+/*
+ * Pins the calling process to the rank-th CPU of its affinity mask.
+ */
+static void __pin(int rank)
+{
+    cpu_set_t allowed;
+    cpu_set_t mine;
+    int nr_cpus;
+    int cpu;
+    int n;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0
+	|| (nr_cpus = CPU_COUNT(&allowed)) == 0) {
+	return;
+    }
+    n = rank % nr_cpus;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+	if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+	    CPU_ZERO(&mine);
+	    CPU_SET(cpu, &mine);
+	    if (sched_setaffinity(0, sizeof(mine), &mine) < 0) {
+		perror("sched_setaffinity");
+	    }
+	    return;
+	}
+    }
+}
+
+/*
+ * Turns into processor rank, returns only if the program cannot be run.
+ */
+static void __exec_proc(int rank, int nr_procs, int *ends, int port,
+			int pin, char **argv, int *out)
+{
+    char number[16];
+    char *fds;
+    char **args;
+    int argc;
+    int len = 0;
+    int i;
+
+    dup2(out[0], STDOUT_FILENO);
+    dup2(out[1], STDERR_FILENO);
+    if (pin) {
+	__pin(rank);
+    }
+
+    if (port) {
+	//root hostname, root port and the rest go after the program's own
+	for (argc = 0; argv[argc]; argc++);
+	args = (char **) malloc(sizeof(char *) * (argc + 6));
+	if (!args) {
+	    return;
+	}
+	memcpy(args, argv, sizeof(char *) * argc);
+	snprintf(number, sizeof(number), "%d", nr_procs);
+	args[argc++] = strdup(number);
+	snprintf(number, sizeof(number), "%d", rank);
+	args[argc++] = strdup(number);
+	args[argc++] = "localhost";
+	args[argc++] = "localhost";
+	snprintf(number, sizeof(number), "%d", port);
+	args[argc++] = strdup(number);
+	args[argc] = NULL;
+	execvp(args[0], args);
+	return;
+    }
+
+    fds = (char *) malloc(nr_procs * sizeof(number));
+    if (!fds) {
+	return;
+    }
+    for (i = 0; i < nr_procs; i++) {
+	//own ends survive exec
+	if (i != rank) {
+	    fcntl(ends[rank * nr_procs + i], F_SETFD, 0);
+	}
+	len += sprintf(fds + len, i ? ",%d" : "%d", ends[rank * nr_procs + i]);
+    }
+    snprintf(number, sizeof(number), "%d", nr_procs);
+    setenv(MYMPI_SIZE_ENV, number, 1);
+    snprintf(number, sizeof(number), "%d", rank);
+    setenv(MYMPI_RANK_ENV, number, 1);
+    setenv(MYMPI_FDS_ENV, fds, 1);
+    execvp(argv[0], argv);
+}
+
+/*
+ * Forwards what a processor wrote, whole lines only unless the buffer is
+ * full or the stream is over.
+ */
+static void __forward(struct output *output)
+{
+    char *end;
+    ssize_t n;
+    size_t len;
+
+    n = read(output->fd, output->buff + output->len,
+	     LINE_BUFFER_SIZE - output->len);
+    if (n < 0 && errno == EINTR) {
+	return;
+    }
+    if (n > 0) {
+	output->len += n;
+    }
+    end = (char *) memrchr(output->buff, '\n', output->len);
+    if (n <= 0 || output->len == LINE_BUFFER_SIZE) {
+	len = output->len;
+    } else {
+	len = end ? (size_t) (end - output->buff + 1) : 0;
+    }
+    if (len > 0) {
+	if (write(output->out, output->buff, len) < 0) {
+	    //nowhere to forward to, keep draining
+	}
+	memmove(output->buff, output->buff + len, output->len - len);
+	output->len -= len;
+    }
+    if (n <= 0) {
+	close(output->fd);
+	output->fd = -1;
+    }
+}
+
+/*
+ * Reaps processors which are done without waiting. The first failure is
+ * kept in status and takes the rest of the job down.
+ * Return value
+ *     number of processors still running
+ */
+static int __reap(struct proc *procs, int nr_procs, int hang, int *status)
+{
+    int running = 0;
+    int code;
+    int ret;
+    int i;
+
+    for (i = 0; i < nr_procs; i++) {
+	if (!procs[i].pid) {
+	    continue;
+	}
+	if (waitpid(procs[i].pid, &ret, hang ? 0 : WNOHANG) <= 0) {
+	    running++;
+	    continue;
+	}
+	procs[i].pid = 0;
+	code = WIFEXITED(ret) ? WEXITSTATUS(ret) : 128 + WTERMSIG(ret);
+	if (code != 0 && *status == 0) {
+	    fprintf(stderr, "mpirun: rank %d exited with status %d, "
+		    "aborting job\n", i, code);
+	    *status = code;
+	}
+    }
+    if (*status != 0) {
+	for (i = 0; i < nr_procs; i++) {
+	    if (procs[i].pid) {
+		kill(procs[i].pid, SIGTERM);
+	    }
+	}
+    }
+    return running;
+}
+
+int main(int argc, char *argv[])
+{
+    struct pollfd *pfds;
+    struct output **polled;
+    struct proc *procs;
+    int *ends = NULL;
+    int nr_procs = DEFAULT_NR_PROCS;
+    int port = 0;
+    int pin = FALSE;
+    int status = 0;
+    int nr_open;
+    int out[2][2];
+    int opt;
+    int i;
+    int j;
+
+    //options end at the program
+    while ((opt = getopt(argc, argv, "+n:bp:")) != -1) {
+	switch (opt) {
+	case 'n':
+	    nr_procs = atoi(optarg);
+	    break;
+	case 'b':
+	    pin = TRUE;
+	    break;
+	case 'p':
+	    port = atoi(optarg);
+	    break;
+	default:
+	    __usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (optind == argc || nr_procs < 1 || port < 0 || port > 65535) {
+	__usage(argv[0]);
+	return 1;
+    }
+
+    procs = (struct proc *) calloc(nr_procs, sizeof(struct proc));
+    pfds = (struct pollfd *) malloc(sizeof(struct pollfd) * nr_procs * 2);
+    polled = (struct output **)
+	malloc(sizeof(struct output *) * nr_procs * 2);
+    if (!port) {
+	__raise_fd_limit(nr_procs);
+	ends = (int *) malloc(sizeof(int) * nr_procs * nr_procs);
+    }
+    if (!procs || !pfds || !polled || (!port && !ends)) {
+	fprintf(stderr, "mpirun: out of memory\n");
+	return 1;
+    }
+    if (!port && __connect_pairs(nr_procs, ends) < 0) {
+	return 1;
+    }
+    //a processor gone before reading its output must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < nr_procs; i++) {
+	if (pipe2(out[0], O_CLOEXEC) < 0 || pipe2(out[1], O_CLOEXEC) < 0) {
+	    perror("pipe");
+	    status = 1;
+	    break;
+	}
+	procs[i].pid = fork();
+	if (procs[i].pid < 0) {
+	    perror("fork");
+	    procs[i].pid = 0;
+	    status = 1;
+	    break;
+	}
+	if (procs[i].pid == 0) {
+	    int fds[2] = { out[0][1], out[1][1] };
+
+	    __exec_proc(i, nr_procs, ends, port, pin, argv + optind, fds);
+	    fprintf(stderr, "mpirun: failed to run %s: %s\n", argv[optind],
+		    strerror(errno));
+	    _exit(127);
+	}
+	for (j = 0; j < 2; j++) {
+	    close(out[j][1]);
+	    procs[i].output[j].fd = out[j][0];
+	    procs[i].output[j].out = j ? STDERR_FILENO : STDOUT_FILENO;
+	}
+	//processor i holds its ends now
+	for (j = 0; !port && j < nr_procs; j++) {
+	    if (j != i) {
+		close(ends[i * nr_procs + j]);
+	    }
+	}
+    }
+    if (status != 0) {
+	__reap(procs, nr_procs, FALSE, &status);
+    }
+
+    //forward output till every processor closed it
+    do {
+	nr_open = 0;
+	for (i = 0; i < nr_procs; i++) {
+	    for (j = 0; j < 2; j++) {
+		if (procs[i].output[j].fd > 0) {
+		    pfds[nr_open].fd = procs[i].output[j].fd;
+		    pfds[nr_open].events = POLLIN;
+		    polled[nr_open++] = &procs[i].output[j];
+		}
+	    }
+	}
+	if (nr_open == 0) {
+	    break;
+	}
+	if (poll(pfds, nr_open, REAP_INTERVAL) < 0 && errno != EINTR) {
+	    perror("poll");
+	    break;
+	}
+	for (i = 0; i < nr_open; i++) {
+	    if (pfds[i].revents) {
+		__forward(polled[i]);
+	    }
+	}
+	__reap(procs, nr_procs, FALSE, &status);
+    } while (TRUE);
+
+    __reap(procs, nr_procs, TRUE, &status);
+    free(ends);
+    free(polled);
+    free(pfds);
+    free(procs);
+    return status;
+}
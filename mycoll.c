@@ -0,0 +1,2029 @@
+/**
+ * Implementation of collective operations.
+ *
+ * Processors are renumbered relative to the root of the operation so
+ * that every algorithm can be written as if the root was rank 0. Scheduled
+ * algorithms run over a group of processors, either all of them or, when
+ * processors span several nodes, those of one node or the node leaders.
+ */
+#include "mycoll.h"
+#include "myprogress.h"
+#include "mysched.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*Define boolean values*/
+#define FALSE              0
+#define TRUE               1
+
+/*Broadcasts up to this many bytes use binomial tree, longer ones are
+ *pipelined in segments down a chain*/
+#define BCAST_LONG_MSG       262144
+#define BCAST_SEGMENT_SIZE   65536
+
+/*Gathers and scatters with blocks of up to this many bytes per processor
+ *use binomial tree, larger blocks are exchanged with root directly*/
+#define GATHER_LONG_BLOCK    8192
+
+/*All-to-all exchanges with blocks of up to this many bytes use Bruck,
+ *larger blocks are exchanged pairwise with at most ALLTOALL_WINDOW steps
+ *in flight*/
+#define ALLTOALL_SHORT_BLOCK 256
+#define ALLTOALL_WINDOW      8
+
+/*Allgathers of up to ALLGATHER_SHORT_MSG bytes in total use recursive
+ *doubling on a power of two processors or Bruck on any other number,
+ *power of two ones keep recursive doubling up to ALLGATHER_LONG_MSG and
+ *longer ones go around the ring*/
+#define ALLGATHER_SHORT_MSG  81920
+#define ALLGATHER_LONG_MSG   524288
+
+/*Reductions of up to this many bytes use binomial tree or recursive
+ *doubling, longer ones are reduce-scattered around a ring so that every
+ *processor combines only its share of the vector*/
+#define REDUCE_LONG_MSG      65536
+
+/*Sequence number of the next scheduled collective*/
+static unsigned int coll_seq = 0;
+
+/*Processors taking part in a phase of a collective, member i is ranks[i]
+ *or rank i of all processors when ranks is NULL*/
+struct coll_group {
+    const int *ranks;
+    int size;
+    int index;			/*member which is this processor */
+};
+
+/*Layout of processors over nodes, filled in by coll_init*/
+static int *node_of = NULL;	/*node of every rank */
+static int *leader_ranks = NULL;	/*lowest rank of every node */
+static int *local_ranks = NULL;	/*ranks of this node */
+static struct coll_group leader_group;
+static struct coll_group local_group;
+static int hier_enabled = FALSE;	/*split collectives by node */
+
+/*
+ * Splits count elements into size nearly equal blocks and returns first
+ * element and length of block, the first count % size blocks get one
+ * element more.
+ */
+static void __block_range(int count, int size, int block, int *first,
+			  int *len)
+{
+    int base = count / size;
+    int extra = count % size;
+
+    *first = block * base + (block < extra ? block : extra);
+    *len = base + (block < extra ? 1 : 0);
+}
+
+/*
+ * Returns tag of the next scheduled collective. Non-blocking collectives
+ * may be outstanding together, so their messages carry the sequence
+ * number of the operation as well, which all processors count alike.
+ */
+static int __coll_tag(int tag)
+{
+    return COLL_TAG_SEQ(tag, coll_seq++);
+}
+
+/*
+ * Runs schedule of a blocking collective to completion.
+ */
+static int __sched_run(struct sched *sched)
+{
+    MPI_Request request;
+    int ret = progress_isched(sched, &request);
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/*
+ * Returns rank of member i of group.
+ */
+static inline int __member(const struct coll_group *group, int i)
+{
+    return group->ranks ? group->ranks[i] : i;
+}
+
+/*
+ * Fills in the group of all processors.
+ */
+static void __world_group(struct coll_group *group)
+{
+    group->ranks = NULL;
+    group->size = commtab->size;
+    group->index = commtab->rank;
+}
+
+/*
+ * Returns index of rank in the group of this node.
+ */
+static int __local_index(int rank)
+{
+    int i;
+
+    for (i = 0; i < local_group.size; i++) {
+	if (local_ranks[i] == rank) {
+	    return i;
+	}
+    }
+    return 0;
+}
+
+int coll_init(void)
+{
+    char *enable = getenv(COLL_HIER_ENV);
+    int size = commtab->size;
+    int nr_nodes = 0;
+    int node;
+    int i;
+
+    node_of = (int *) malloc(sizeof(int) * size);
+    leader_ranks = (int *) malloc(sizeof(int) * size);
+    local_ranks = (int *) malloc(sizeof(int) * size);
+    if (!node_of || !leader_ranks || !local_ranks) {
+	dprintf("Failed to allocate node layout\n");
+	coll_finalize();
+	return MPI_ERR_OTHER;
+    }
+
+    //ranks share a node when they share an address, the lowest one leads
+    for (i = 0; i < size; i++) {
+	for (node = 0; node < nr_nodes; node++) {
+	    if (commtab->ctable[leader_ranks[node]].address ==
+		commtab->ctable[i].address) {
+		break;
+	    }
+	}
+	if (node == nr_nodes) {
+	    leader_ranks[nr_nodes++] = i;
+	}
+	node_of[i] = node;
+    }
+
+    leader_group.ranks = leader_ranks;
+    leader_group.size = nr_nodes;
+    leader_group.index = node_of[commtab->rank];
+    local_group.ranks = local_ranks;
+    local_group.size = 0;
+    for (i = 0; i < size; i++) {
+	if (node_of[i] == leader_group.index) {
+	    if (i == commtab->rank) {
+		local_group.index = local_group.size;
+	    }
+	    local_ranks[local_group.size++] = i;
+	}
+    }
+
+    hier_enabled = nr_nodes > 1 && nr_nodes < size
+	&& (!enable || strcmp(enable, "0") != 0);
+    dprintf("Collectives span %d nodes, %d processors on this one, "
+	    "hierarchy %s\n",
+	    nr_nodes, local_group.size, hier_enabled ? "on" : "off");
+    return MPI_SUCCESS;
+}
+
+void coll_finalize(void)
+{
+    free(node_of);
+    free(leader_ranks);
+    free(local_ranks);
+    node_of = leader_ranks = local_ranks = NULL;
+    hier_enabled = FALSE;
+}
+
+/*
+ * Broadcast down a binomial tree in ceil(log2(size)) rounds. Relative
+ * index vrank receives from the member with its lowest set bit cleared
+ * and then forwards to vrank + 2^k for every 2^k below that bit, largest
+ * subtree first.
+ */
+static void __sched_bcast_binomial(struct sched *sched,
+				   const struct coll_group *group, char *buff,
+				   unsigned int length, int root, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int vrank = (index - root + size) % size;
+    int mask = 1;
+
+    while (mask < size) {
+	if (vrank & mask) {
+	    sched_recv(sched, buff, length,
+		       __member(group, (index - mask + size) % size), tag);
+	    sched_fence(sched);
+	    break;
+	}
+	mask <<= 1;
+    }
+
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+	if (vrank + mask < size) {
+	    sched_send(sched, buff, length,
+		       __member(group, (index + mask) % size), tag);
+	}
+    }
+}
+
+/*
+ * Broadcast pipelined down the chain of relative indices. Message is cut
+ * into segments and every processor forwards a segment as soon as it has
+ * it, so after the pipeline fills all links carry data at the same time.
+ */
+static void __sched_bcast_pipeline(struct sched *sched,
+				   const struct coll_group *group, char *buff,
+				   unsigned int length, int root, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int vrank = (index - root + size) % size;
+    int prev = __member(group, (index - 1 + size) % size);
+    int next = __member(group, (index + 1) % size);
+    int nr_segments = (length + BCAST_SEGMENT_SIZE - 1) / BCAST_SEGMENT_SIZE;
+    unsigned int offset;
+    unsigned int seg_len;
+    int first_recv = 0;
+    int step;
+    int i;
+
+    //post all segment receives up front so none arrives unexpected
+    if (vrank > 0) {
+	for (i = 0; i < nr_segments; i++) {
+	    offset = i * BCAST_SEGMENT_SIZE;
+	    seg_len = length - offset < BCAST_SEGMENT_SIZE ?
+		length - offset : BCAST_SEGMENT_SIZE;
+	    step = sched_recv(sched, buff + offset, seg_len, prev, tag);
+	    if (i == 0) {
+		first_recv = step;
+	    }
+	}
+    }
+
+    for (i = 0; i < nr_segments; i++) {
+	offset = i * BCAST_SEGMENT_SIZE;
+	seg_len = length - offset < BCAST_SEGMENT_SIZE ?
+	    length - offset : BCAST_SEGMENT_SIZE;
+	if (vrank > 0) {
+	    sched_wait(sched, first_recv + i);
+	}
+	if (vrank < size - 1) {
+	    sched_send(sched, buff + offset, seg_len, next, tag);
+	}
+    }
+}
+
+/*
+ * Broadcast within group, picking the algorithm by message length. Short
+ * messages are latency bound and take the binomial tree, long ones are
+ * bandwidth bound and take the pipeline, which keeps root from sending
+ * the whole message more than once.
+ */
+static void __sched_bcast(struct sched *sched, const struct coll_group *group,
+			  char *buff, unsigned int length, int root, int tag)
+{
+    if (group->size == 1 || length == 0) {
+	return;
+    }
+    if (length <= BCAST_LONG_MSG || group->size == 2) {
+	__sched_bcast_binomial(sched, group, buff, length, root, tag);
+    } else {
+	__sched_bcast_pipeline(sched, group, buff, length, root, tag);
+    }
+}
+
+/*
+ * Barrier by dissemination: in round k every member signals the one 2^k
+ * ahead and waits for the one 2^k behind, so after ceil(log2(size))
+ * rounds of empty messages each member has heard, directly or not, from
+ * all the others.
+ */
+static void __sched_barrier_dissemination(struct sched *sched,
+					  const struct coll_group *group,
+					  int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int dist;
+
+    for (dist = 1; dist < size; dist <<= 1) {
+	sched_recv(sched, NULL, 0, __member(group, (index - dist + size) %
+					    size), tag);
+	sched_send(sched, NULL, 0, __member(group, (index + dist) % size), tag);
+	sched_fence(sched);
+    }
+}
+
+/*
+ * Number of blocks in the binomial subtree of relative rank vrank. The
+ * subtree spans the ranks from vrank below the next multiple of its lowest
+ * set bit, clipped at size, and root spans all of them.
+ */
+static int __subtree_blocks(int vrank, int size)
+{
+    int span = vrank == 0 ? size : (vrank & -vrank);
+
+    return span < size - vrank ? span : size - vrank;
+}
+
+/*
+ * Gather up a binomial tree. Relative rank vrank receives the subtrees of
+ * its children vrank + 2^k, which are contiguous in relative rank order,
+ * right after its own block and passes all of them to its parent in one
+ * message. Leaves send straight from sendbuf. Root 0 receives in place,
+ * any other root rotates the blocks into recvbuf at the end.
+ */
+static void __sched_gather_binomial(struct sched *sched, void *sendbuf,
+				    char *recvbuf, unsigned int block,
+				    int root, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int vrank = (rank - root + size) % size;
+    int parent = (rank - (vrank & -vrank) + size) % size;
+    int nr_blocks = __subtree_blocks(vrank, size);
+    char *buff = recvbuf;
+    int first;
+    int mask;
+
+    if (nr_blocks == 1) {
+	sched_send(sched, sendbuf, block, parent, tag);
+	return;
+    }
+    if (vrank != 0 || root != 0) {
+	buff = (char *) sched_scratch(sched, nr_blocks * block);
+	if (!buff) {
+	    return;
+	}
+    }
+    if (sendbuf != MPI_IN_PLACE) {
+	sched_copy(sched, buff, sendbuf, block);
+    }
+
+    for (mask = 1; mask < nr_blocks; mask <<= 1) {
+	sched_recv(sched, buff + mask * block,
+		   __subtree_blocks(vrank + mask, size) * block,
+		   (rank + mask) % size, tag);
+    }
+    sched_fence(sched);
+
+    if (vrank != 0) {
+	sched_send(sched, buff, nr_blocks * block, parent, tag);
+    } else if (buff != recvbuf) {
+	//block of relative rank v belongs to rank (v + root) % size
+	first = sendbuf == MPI_IN_PLACE ? 1 : 0;
+	sched_copy(sched, recvbuf + (root + first) * block,
+		   buff + first * block, (size - root - first) * block);
+	sched_copy(sched, recvbuf, buff + (size - root) * block,
+		   root * block);
+    }
+}
+
+/*
+ * Scatter down a binomial tree, the reverse of __sched_gather_binomial.
+ * Every processor receives the blocks of its whole subtree from its parent
+ * and hands each child its subtree, largest first. Leaves receive straight
+ * into recvbuf and root 0 sends straight from sendbuf.
+ */
+static void __sched_scatter_binomial(struct sched *sched, char *sendbuf,
+				     void *recvbuf, unsigned int block,
+				     int root, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int vrank = (rank - root + size) % size;
+    int parent = (rank - (vrank & -vrank) + size) % size;
+    int nr_blocks = __subtree_blocks(vrank, size);
+    char *buff = sendbuf;
+    int mask;
+
+    if (nr_blocks == 1) {
+	sched_recv(sched, recvbuf, block, parent, tag);
+	return;
+    }
+    if (vrank != 0 || root != 0) {
+	buff = (char *) sched_scratch(sched, nr_blocks * block);
+	if (!buff) {
+	    return;
+	}
+    }
+    if (vrank != 0) {
+	sched_recv(sched, buff, nr_blocks * block, parent, tag);
+	sched_fence(sched);
+    } else if (buff != sendbuf) {
+	//put blocks in relative rank order
+	sched_copy(sched, buff, sendbuf + root * block, (size - root) * block);
+	sched_copy(sched, buff + (size - root) * block, sendbuf, root * block);
+    }
+
+    for (mask = 1; mask * 2 < nr_blocks; mask <<= 1);
+    for (; mask > 0; mask >>= 1) {
+	sched_send(sched, buff + mask * block,
+		   __subtree_blocks(vrank + mask, size) * block,
+		   (rank + mask) % size, tag);
+    }
+    if (recvbuf != MPI_IN_PLACE) {
+	sched_copy(sched, recvbuf, buff, block);
+    }
+}
+
+/*
+ * Gather straight into place: root posts a receive for every block at its
+ * displacement in recvbuf, so blocks are taken in whatever order they
+ * arrive. Without recvcounts every processor contributes sendlen bytes and
+ * blocks follow each other in rank order.
+ * Return value
+ *     MPI_ERR_TRUNCATE if own block of root does not fit in its place and
+ *     is left out, MPI_SUCCESS otherwise
+ */
+static int __sched_gatherv_linear(struct sched *sched, void *sendbuf,
+				  unsigned int sendlen, char *recvbuf,
+				  const int *recvcounts, const int *displs,
+				  int esize, int root, int tag)
+{
+    int size = commtab->size;
+    unsigned int offset;
+    unsigned int len;
+    int ret = MPI_SUCCESS;
+    int i;
+
+    if (commtab->rank != root) {
+	sched_send(sched, sendbuf, sendlen, root, tag);
+	return MPI_SUCCESS;
+    }
+
+    for (i = 0; i < size; i++) {
+	offset = recvcounts ? (unsigned int) displs[i] * esize : i * sendlen;
+	len = recvcounts ? (unsigned int) recvcounts[i] * esize : sendlen;
+	if (i != root) {
+	    sched_recv(sched, recvbuf + offset, len, i, tag);
+	} else if (sendbuf == MPI_IN_PLACE) {
+	    continue;
+	} else if (sendlen > len) {
+	    ret = MPI_ERR_TRUNCATE;
+	} else {
+	    sched_copy(sched, recvbuf + offset, sendbuf, sendlen);
+	}
+    }
+    return ret;
+}
+
+/*
+ * Scatter straight from place: root starts sending every block from its
+ * displacement in sendbuf at once. Without sendcounts every processor
+ * gets recvlen bytes and blocks follow each other in rank order.
+ * Return value
+ *     MPI_ERR_TRUNCATE if own block of root does not fit in recvbuf and is
+ *     left out, MPI_SUCCESS otherwise
+ */
+static int __sched_scatterv_linear(struct sched *sched, char *sendbuf,
+				   const int *sendcounts, const int *displs,
+				   int esize, void *recvbuf,
+				   unsigned int recvlen, int root, int tag)
+{
+    int size = commtab->size;
+    unsigned int offset;
+    unsigned int len;
+    int ret = MPI_SUCCESS;
+    int i;
+
+    if (commtab->rank != root) {
+	sched_recv(sched, recvbuf, recvlen, root, tag);
+	return MPI_SUCCESS;
+    }
+
+    for (i = 0; i < size; i++) {
+	offset = sendcounts ? (unsigned int) displs[i] * esize : i * recvlen;
+	len = sendcounts ? (unsigned int) sendcounts[i] * esize : recvlen;
+	if (i != root) {
+	    sched_send(sched, sendbuf + offset, len, i, tag);
+	} else if (recvbuf == MPI_IN_PLACE) {
+	    continue;
+	} else if (len > recvlen) {
+	    ret = MPI_ERR_TRUNCATE;
+	} else {
+	    sched_copy(sched, recvbuf, sendbuf + offset, len);
+	}
+    }
+    return ret;
+}
+
+/*
+ * Returns offset and length in bytes of block i of a buffer described by
+ * counts and displs of esize byte elements. Without counts every block is
+ * esize bytes and blocks follow each other in rank order.
+ */
+static void __vblock(const int *counts, const int *displs, unsigned int esize,
+		     int i, unsigned int *offset, unsigned int *len)
+{
+    if (counts) {
+	*offset = (unsigned int) displs[i] * esize;
+	*len = (unsigned int) counts[i] * esize;
+    } else {
+	*offset = i * esize;
+	*len = esize;
+    }
+}
+
+/*
+ * All-to-all exchange by the Bruck algorithm in ceil(log2(size)) rounds.
+ * Blocks are first rotated so that block i is the one for rank + i. In
+ * round k every processor packs the blocks whose index has bit k set, sends
+ * them to rank + 2^k and unpacks what comes from rank - 2^k in their
+ * place. Afterwards block i came from rank - i and a final rotation puts
+ * it in place. Every block travels up to log2(size) hops, which pays for
+ * short blocks only.
+ */
+static void __sched_alltoall_bruck(struct sched *sched, char *sendbuf,
+				   char *recvbuf, unsigned int block, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int max_blocks = size / 2 + 1;
+    char *tmp;
+    char *spack;
+    char *rpack;
+    int nr_blocks;
+    int mask;
+    int i;
+
+    tmp = (char *) sched_scratch(sched, (size + max_blocks * 2) * block);
+    if (!tmp) {
+	return;
+    }
+    spack = tmp + size * block;
+    rpack = spack + max_blocks * block;
+
+    for (i = 0; i < size; i++) {
+	sched_copy(sched, tmp + i * block, sendbuf + ((rank + i) % size) * block,
+		   block);
+    }
+
+    for (mask = 1; mask < size; mask <<= 1) {
+	nr_blocks = 0;
+	for (i = mask; i < size; i++) {
+	    if (i & mask) {
+		sched_copy(sched, spack + nr_blocks++ * block, tmp + i * block,
+			   block);
+	    }
+	}
+	sched_recv(sched, rpack, nr_blocks * block, (rank - mask + size) % size,
+		   tag);
+	sched_send(sched, spack, nr_blocks * block, (rank + mask) % size, tag);
+	sched_fence(sched);
+	nr_blocks = 0;
+	for (i = mask; i < size; i++) {
+	    if (i & mask) {
+		sched_copy(sched, tmp + i * block, rpack + nr_blocks++ * block,
+			   block);
+	    }
+	}
+    }
+
+    for (i = 0; i < size; i++) {
+	sched_copy(sched, recvbuf + ((rank - i + size) % size) * block,
+		   tmp + i * block, block);
+    }
+}
+
+/*
+ * All-to-all exchange in size - 1 pairwise steps. In step s every
+ * processor sends its block for rank + s straight from sendbuf and
+ * receives the block of rank - s straight into recvbuf, so every link
+ * carries one block per step. Up to ALLTOALL_WINDOW steps are in flight
+ * to keep the links busy without flooding slow receivers with unexpected
+ * messages.
+ * Return value
+ *     MPI_ERR_TRUNCATE if own block does not fit in its place and is left
+ *     out, MPI_SUCCESS otherwise
+ */
+static int __sched_alltoallv_pairwise(struct sched *sched, char *sendbuf,
+				      const int *sendcounts,
+				      const int *sdispls,
+				      unsigned int sendesize, char *recvbuf,
+				      const int *recvcounts,
+				      const int *rdispls,
+				      unsigned int recvesize, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int window[ALLTOALL_WINDOW * 2];	/*steps using every slot */
+    unsigned int soffset, slen;
+    unsigned int roffset, rlen;
+    int ret = MPI_SUCCESS;
+    int slot;
+    int step;
+    int i;
+
+    for (i = 0; i < ALLTOALL_WINDOW * 2; i++) {
+	window[i] = -1;
+    }
+
+    __vblock(sendcounts, sdispls, sendesize, rank, &soffset, &slen);
+    __vblock(recvcounts, rdispls, recvesize, rank, &roffset, &rlen);
+    if (slen > rlen) {
+	ret = MPI_ERR_TRUNCATE;
+    } else {
+	sched_copy(sched, recvbuf + roffset, sendbuf + soffset, slen);
+    }
+
+    for (step = 1; step < size; step++) {
+	slot = (step % ALLTOALL_WINDOW) * 2;
+	//step which had the slot before finishes first
+	if (window[slot] >= 0) {
+	    sched_wait(sched, window[slot]);
+	    sched_wait(sched, window[slot + 1]);
+	}
+	__vblock(recvcounts, rdispls, recvesize, (rank - step + size) % size,
+		 &roffset, &rlen);
+	window[slot] = sched_recv(sched, recvbuf + roffset, rlen,
+				  (rank - step + size) % size, tag);
+	__vblock(sendcounts, sdispls, sendesize, (rank + step) % size,
+		 &soffset, &slen);
+	window[slot + 1] = sched_send(sched, sendbuf + soffset, slen,
+				      (rank + step) % size, tag);
+    }
+    return ret;
+}
+
+/*
+ * Allgather by recursive doubling in log2(size) rounds, size must be a
+ * power of two. Before round k every processor holds the 2^k blocks of
+ * its aligned group of ranks and swaps them with rank ^ 2^k, straight
+ * within recvbuf, doubling its group.
+ */
+static void __sched_allgather_recursive_doubling(struct sched *sched,
+						 char *recvbuf,
+						 unsigned int block, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int peer;
+    int mask;
+
+    for (mask = 1; mask < size; mask <<= 1) {
+	peer = rank ^ mask;
+	sched_recv(sched, recvbuf + (peer & ~(mask - 1)) * block,
+		   mask * block, peer, tag);
+	sched_send(sched, recvbuf + (rank & ~(mask - 1)) * block,
+		   mask * block, peer, tag);
+	sched_fence(sched);
+    }
+}
+
+/*
+ * Allgather by the Bruck algorithm in ceil(log2(size)) rounds on any
+ * number of processors. Blocks are collected in scratch in relative
+ * order, block i being the one of rank + i. In round k every processor
+ * sends the first 2^k blocks it has to rank - 2^k and appends those of
+ * rank + 2^k, and a final rotation puts them in place in recvbuf. Own
+ * block must already be in place.
+ */
+static void __sched_allgatherv_bruck(struct sched *sched, char *recvbuf,
+				     const int *counts, const int *displs,
+				     unsigned int esize, int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    unsigned int *roffsets;
+    unsigned int offset, len;
+    unsigned int total = 0;
+    char *tmp;
+    int nr_blocks;
+    int mask;
+    int i;
+
+    for (i = 0; i < size; i++) {
+	__vblock(counts, displs, esize, i, &offset, &len);
+	total += len;
+    }
+    //offsets of blocks in relative order, roffsets[size] is the total,
+    //followed by the blocks themselves
+    roffsets = (unsigned int *)
+	sched_scratch(sched, sizeof(unsigned int) * (size + 1) + total);
+    if (!roffsets) {
+	return;
+    }
+    tmp = (char *) (roffsets + size + 1);
+    roffsets[0] = 0;
+    for (i = 0; i < size; i++) {
+	__vblock(counts, displs, esize, (rank + i) % size, &offset, &len);
+	roffsets[i + 1] = roffsets[i] + len;
+    }
+
+    __vblock(counts, displs, esize, rank, &offset, &len);
+    sched_copy(sched, tmp, recvbuf + offset, len);
+    for (mask = 1; mask < size; mask <<= 1) {
+	nr_blocks = mask < size - mask ? mask : size - mask;
+	sched_recv(sched, tmp + roffsets[mask],
+		   roffsets[mask + nr_blocks] - roffsets[mask],
+		   (rank + mask) % size, tag);
+	sched_send(sched, tmp, roffsets[nr_blocks], (rank - mask + size) % size,
+		   tag);
+	sched_fence(sched);
+    }
+
+    for (i = 1; i < size; i++) {
+	__vblock(counts, displs, esize, (rank + i) % size, &offset, &len);
+	sched_copy(sched, recvbuf + offset, tmp + roffsets[i], len);
+    }
+}
+
+/*
+ * Checks that op is defined for datatype and returns its kernel.
+ */
+static int __check_op(MPI_Datatype datatype, MPI_Op op, op_kernel_t * kernel)
+{
+    if (op < 0 || op >= MPI_OP_COUNT
+	|| !datatype_mappings[datatype].ops[op]) {
+	return MPI_ERR_OP;
+    }
+    *kernel = datatype_mappings[datatype].ops[op];
+    return MPI_SUCCESS;
+}
+
+/*
+ * Reduce-scatter around the ring in size - 1 steps. In every step a
+ * member passes one block of acc to the next member and combines the
+ * block coming from the previous one into acc, so each block collects
+ * one more contribution per step. Afterwards block (index + 1) % size of
+ * acc holds the complete result. tmp must hold the largest block.
+ */
+static void __sched_reduce_scatter_ring(struct sched *sched,
+					const struct coll_group *group,
+					char *acc, char *tmp, int count,
+					int esize, op_kernel_t kernel, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int next = __member(group, (index + 1) % size);
+    int prev = __member(group, (index - 1 + size) % size);
+    int send_first, send_len, recv_first, recv_len;
+    int step;
+
+    for (step = 0; step < size - 1; step++) {
+	__block_range(count, size, (index - step + size) % size,
+		      &send_first, &send_len);
+	__block_range(count, size, (index - step - 1 + 2 * size) % size,
+		      &recv_first, &recv_len);
+	sched_recv(sched, tmp, recv_len * esize, prev, tag);
+	sched_send(sched, acc + send_first * esize, send_len * esize, next,
+		   tag);
+	sched_fence(sched);
+	sched_reduce(sched, acc + recv_first * esize, tmp, recv_len, kernel);
+    }
+}
+
+/*
+ * Returns offset and length in bytes of block i of a vector of esize byte
+ * elements, laid out by counts and displs or, without counts, of count
+ * elements split into size blocks by __block_range.
+ */
+static void __ring_block(const int *counts, const int *displs, int count,
+			 int esize, int size, int i, unsigned int *offset,
+			 unsigned int *len)
+{
+    int first, n;
+
+    if (counts) {
+	__vblock(counts, displs, esize, i, offset, len);
+	return;
+    }
+    __block_range(count, size, i, &first, &n);
+    *offset = first * esize;
+    *len = n * esize;
+}
+
+/*
+ * Allgather around the ring in size - 1 steps. Member index starts with
+ * block (index + shift) % size in place and forwards the block it got
+ * last, which is received straight into its place in buff, so each member
+ * sends and receives every block once whatever the number of members.
+ * Allreduce follows __sched_reduce_scatter_ring with it at shift 1.
+ */
+static void __sched_allgather_ring(struct sched *sched,
+				   const struct coll_group *group, char *buff,
+				   const int *counts, const int *displs,
+				   int count, int esize, int shift, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int next = __member(group, (index + 1) % size);
+    int prev = __member(group, (index - 1 + size) % size);
+    unsigned int soffset, slen;
+    unsigned int roffset, rlen;
+    int step;
+
+    for (step = 0; step < size - 1; step++) {
+	__ring_block(counts, displs, count, esize, size,
+		     (index + shift - step + size) % size, &soffset, &slen);
+	__ring_block(counts, displs, count, esize, size,
+		     (index + shift - step - 1 + size) % size, &roffset,
+		     &rlen);
+	sched_recv(sched, buff + roffset, rlen, prev, tag);
+	sched_send(sched, buff + soffset, slen, next, tag);
+	sched_fence(sched);
+    }
+}
+
+/*
+ * Reduction up a binomial tree rooted at member root. Relative index
+ * vrank collects the results of its subtrees, children vrank + 2^k for
+ * every 2^k below its lowest set bit, and passes the result to its
+ * parent. Without kernel nothing is combined and the tree only gathers
+ * signals.
+ */
+static void __sched_reduce_binomial(struct sched *sched,
+				    const struct coll_group *group, char *acc,
+				    char *tmp, int count, int esize,
+				    op_kernel_t kernel, int root, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int vrank = (index - root + size) % size;
+    unsigned int length = count * esize;
+    int mask;
+
+    for (mask = 1; mask < size; mask <<= 1) {
+	if (vrank & mask) {
+	    sched_send(sched, acc, length,
+		       __member(group, (index - mask + size) % size), tag);
+	    return;
+	}
+	if (vrank + mask < size) {
+	    sched_recv(sched, tmp, length,
+		       __member(group, (index + mask) % size), tag);
+	    sched_fence(sched);
+	    if (kernel) {
+		sched_reduce(sched, acc, tmp, count, kernel);
+	    }
+	}
+    }
+}
+
+/*
+ * Reduction of a long vector to member root: reduce-scatter around the
+ * ring followed by every member sending its block of the result to root.
+ */
+static void __sched_reduce_ring(struct sched *sched,
+				const struct coll_group *group, char *acc,
+				char *tmp, int count, int esize,
+				op_kernel_t kernel, int root, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    int first, len;
+    int i;
+
+    __sched_reduce_scatter_ring(sched, group, acc, tmp, count, esize, kernel,
+				tag);
+    if (index != root) {
+	__block_range(count, size, (index + 1) % size, &first, &len);
+	sched_send(sched, acc + first * esize, len * esize,
+		   __member(group, root), tag);
+	return;
+    }
+    for (i = 0; i < size; i++) {
+	if (i != root) {
+	    __block_range(count, size, (i + 1) % size, &first, &len);
+	    sched_recv(sched, acc + first * esize, len * esize,
+		       __member(group, i), tag);
+	}
+    }
+}
+
+/*
+ * Allreduce by recursive doubling in log2 rounds of pairwise exchanges.
+ * With a size which is not a power of two, the first 2 * rem members
+ * pair up first: even ones hand their vector to the odd neighbour and
+ * sit out, receiving the result at the end.
+ */
+static void __sched_allreduce_recursive_doubling(struct sched *sched,
+						 const struct coll_group
+						 *group, char *acc, char *tmp,
+						 int count, int esize,
+						 op_kernel_t kernel, int tag)
+{
+    int size = group->size;
+    int index = group->index;
+    unsigned int length = count * esize;
+    int pof2 = 1;
+    int rem;
+    int newindex;
+    int newpeer;
+    int peer;
+    int mask;
+
+    while (pof2 * 2 <= size) {
+	pof2 *= 2;
+    }
+    rem = size - pof2;
+
+    if (index < 2 * rem) {
+	if (index % 2 == 0) {
+	    sched_send(sched, acc, length, __member(group, index + 1), tag);
+	    sched_fence(sched);
+	    sched_recv(sched, acc, length, __member(group, index + 1), tag);
+	    return;
+	}
+	sched_recv(sched, tmp, length, __member(group, index - 1), tag);
+	sched_fence(sched);
+	sched_reduce(sched, acc, tmp, count, kernel);
+	newindex = index / 2;
+    } else {
+	newindex = index - rem;
+    }
+
+    for (mask = 1; mask < pof2; mask <<= 1) {
+	newpeer = newindex ^ mask;
+	peer = __member(group, newpeer < rem ? newpeer * 2 + 1 :
+			newpeer + rem);
+	sched_recv(sched, tmp, length, peer, tag);
+	sched_send(sched, acc, length, peer, tag);
+	sched_fence(sched);
+	sched_reduce(sched, acc, tmp, count, kernel);
+    }
+
+    if (index < 2 * rem) {
+	sched_send(sched, acc, length, __member(group, index - 1), tag);
+    }
+}
+
+/*
+ * Allreduce within group, picking the algorithm by vector length. Short
+ * vectors take recursive doubling, which needs the fewest rounds; long
+ * ones take reduce-scatter followed by allgather around the ring, which
+ * moves and combines about two vector lengths per member whatever the
+ * number of members. tmp must be as long as the vector.
+ */
+static void __sched_allreduce(struct sched *sched,
+			      const struct coll_group *group, char *acc,
+			      char *tmp, int count, int esize,
+			      op_kernel_t kernel, int tag)
+{
+    if (group->size == 1) {
+	return;
+    }
+    if (count * esize <= REDUCE_LONG_MSG || count < group->size) {
+	__sched_allreduce_recursive_doubling(sched, group, acc, tmp, count,
+					     esize, kernel, tag);
+    } else {
+	__sched_reduce_scatter_ring(sched, group, acc, tmp, count, esize,
+				    kernel, tag);
+	__sched_allgather_ring(sched, group, acc, NULL, NULL, count, esize, 1,
+			       tag);
+    }
+}
+
+/*
+ * Prefix reduction by recursive doubling in ceil(log2(size)) rounds. In
+ * round k every processor swaps the reduction of its aligned group of 2^k
+ * ranks, partial, with rank ^ 2^k and folds the group of the partner into
+ * partial. A group of lower ranks is folded into result as well, so
+ * result collects every rank below. Inclusive scans start with own
+ * vector in result, exclusive ones with has_result false and result is
+ * then first set by the lowest group received. Ops are commutative, so
+ * the order contributions are combined in does not matter.
+ */
+static void __sched_scan_recursive_doubling(struct sched *sched,
+					    char *partial, char *result,
+					    char *tmp, int count, int esize,
+					    op_kernel_t kernel, int has_result,
+					    int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    unsigned int length = count * esize;
+    int peer;
+    int mask;
+
+    for (mask = 1; mask < size; mask <<= 1) {
+	peer = rank ^ mask;
+	if (peer >= size) {
+	    continue;
+	}
+	sched_recv(sched, tmp, length, peer, tag);
+	sched_send(sched, partial, length, peer, tag);
+	sched_fence(sched);
+	sched_reduce(sched, partial, tmp, count, kernel);
+	if (peer < rank) {
+	    if (has_result) {
+		sched_reduce(sched, result, tmp, count, kernel);
+	    } else {
+		sched_copy(sched, result, tmp, length);
+		has_result = TRUE;
+	    }
+	}
+    }
+}
+
+/*
+ * Reduce-scatter by recursive halving in log2 rounds, with counts[i]
+ * elements of the result going to rank i. With a size which is not a
+ * power of two, the first 2 * rem processors pair up first: even ones
+ * hand their vector to the odd neighbour and sit out, receiving their
+ * block at the end. In every round the remaining processors split their
+ * part of the vector with a partner, send one half and combine the
+ * other, so the data sent halves each round. The vector is reduced in
+ * scratch, which holds it twice after the layout of the halved blocks.
+ */
+static void __sched_reduce_scatter_halving(struct sched *sched, void *sendbuf,
+					   char *recvbuf, const int *counts,
+					   int esize, op_kernel_t kernel,
+					   int tag)
+{
+    int size = commtab->size;
+    int rank = commtab->rank;
+    int *newcounts;
+    int *newdispls;
+    char *acc;
+    char *tmp;
+    int pof2 = 1;
+    int rem;
+    int newrank;
+    int newpeer;
+    int peer;
+    int send_idx, recv_idx;
+    int send_count, recv_count;
+    int total = 0;
+    int displ = 0;
+    int mask;
+    int i;
+
+    while (pof2 * 2 <= size) {
+	pof2 *= 2;
+    }
+    rem = size - pof2;
+    for (i = 0; i < size; i++) {
+	total += counts[i];
+    }
+
+    newcounts = (int *) sched_scratch(sched, sizeof(int) * pof2 * 2 +
+				      (size_t) total * esize * 2);
+    if (!newcounts) {
+	return;
+    }
+    newdispls = newcounts + pof2;
+    acc = (char *) (newdispls + pof2);
+    tmp = acc + total * esize;
+    //blocks of a pair which folded together are handled as one
+    for (i = 0; i < pof2; i++) {
+	newdispls[i] = displ;
+	newcounts[i] = i < rem ? counts[i * 2] + counts[i * 2 + 1] :
+	    counts[i + rem];
+	displ += newcounts[i];
+    }
+    sched_copy(sched, acc, sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf,
+	       total * esize);
+
+    if (rank < 2 * rem) {
+	if (rank % 2 == 0) {
+	    sched_send(sched, acc, total * esize, rank + 1, tag);
+	    newrank = -1;
+	} else {
+	    sched_recv(sched, tmp, total * esize, rank - 1, tag);
+	    sched_fence(sched);
+	    sched_reduce(sched, acc, tmp, total, kernel);
+	    newrank = rank / 2;
+	}
+    } else {
+	newrank = rank - rem;
+    }
+
+    if (newrank != -1) {
+	send_idx = recv_idx = 0;
+	for (mask = pof2 / 2; mask > 0; mask >>= 1) {
+	    newpeer = newrank ^ mask;
+	    peer = newpeer < rem ? newpeer * 2 + 1 : newpeer + rem;
+	    //lower rank keeps lower half
+	    if (newrank < newpeer) {
+		send_idx = recv_idx + mask;
+	    } else {
+		recv_idx = send_idx + mask;
+	    }
+	    send_count = recv_count = 0;
+	    for (i = send_idx; i < send_idx + mask; i++) {
+		send_count += newcounts[i];
+	    }
+	    for (i = recv_idx; i < recv_idx + mask; i++) {
+		recv_count += newcounts[i];
+	    }
+	    sched_recv(sched, tmp, recv_count * esize, peer, tag);
+	    sched_send(sched, acc + newdispls[send_idx] * esize,
+		       send_count * esize, peer, tag);
+	    sched_fence(sched);
+	    sched_reduce(sched, acc + newdispls[recv_idx] * esize, tmp,
+			 recv_count, kernel);
+	    send_idx = recv_idx;
+	}
+    }
+
+    //own block starts at the pair's block for a folded odd rank
+    displ = 0;
+    for (i = 0; i < rank; i++) {
+	displ += counts[i];
+    }
+    if (rank < 2 * rem) {
+	if (rank % 2 == 0) {
+	    sched_recv(sched, recvbuf, counts[rank] * esize, rank + 1, tag);
+	} else {
+	    sched_send(sched, acc + (displ - counts[rank - 1]) * esize,
+		       counts[rank - 1] * esize, rank - 1, tag);
+	}
+    }
+    if (newrank != -1) {
+	sched_copy(sched, recvbuf, acc + displ * esize, counts[rank] * esize);
+    }
+}
+
+/**
+ * This function combines vectors of all processors element by element
+ * and leaves the result at root. Short vectors take the binomial tree,
+ * long ones are reduce-scattered around the ring and gathered at root.
+ */
+int MPI_Reduce(void *sendbuf, void *recvbuf, int count,
+	       MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm)
+{
+    int ret = __check_coll_args(count, datatype, root);
+    struct coll_group world;
+    struct sched *sched;
+    op_kernel_t kernel;
+    unsigned int length;
+    int esize;
+    int tag;
+    char *acc;
+    char *tmp;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_op(datatype, op, &kernel)) != MPI_SUCCESS) {
+	return ret;
+    }
+    if (sendbuf == MPI_IN_PLACE && commtab->rank != root) {
+	return MPI_ERR_OTHER;
+    }
+    esize = datatype_mappings[datatype].size;
+    length = esize * count;
+    if (length == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_REDUCE);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    //root reduces into its receive buffer, others into scratch
+    tmp = (char *) sched_scratch(sched, commtab->rank == root ?
+				 length : length * 2);
+    if (!tmp) {
+	sched_free(sched);
+	return MPI_ERR_OTHER;
+    }
+    acc = commtab->rank == root ? (char *) recvbuf : tmp + length;
+    if (sendbuf != MPI_IN_PLACE) {
+	memcpy(acc, sendbuf, length);
+    }
+
+    __world_group(&world);
+    if (commtab->size == 1) {
+	//nothing to combine
+    } else if (length <= REDUCE_LONG_MSG || count < commtab->size) {
+	__sched_reduce_binomial(sched, &world, acc, tmp, count, esize, kernel,
+				root, tag);
+    } else {
+	__sched_reduce_ring(sched, &world, acc, tmp, count, esize, kernel,
+			    root, tag);
+    }
+    return __sched_run(sched);
+}
+
+/**
+ * This function starts combining vectors of all processors element by
+ * element, leaving the result at every processor. Across several nodes
+ * the vectors of a node are first reduced to its leader, leaders combine
+ * their results among themselves and then broadcast them within their
+ * node, so only leaders talk over the network.
+ */
+int MPI_Iallreduce(void *sendbuf, void *recvbuf, int count,
+		   MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+		   MPI_Request * request)
+{
+    int ret = __check_coll_args(count, datatype, 0);
+    struct coll_group world;
+    struct sched *sched;
+    op_kernel_t kernel;
+    unsigned int length;
+    int esize;
+    int tag;
+    char *tmp;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_op(datatype, op, &kernel)) != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    esize = datatype_mappings[datatype].size;
+    length = esize * count;
+    tag = __coll_tag(COLL_TAG_ALLREDUCE);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+    if (sendbuf != MPI_IN_PLACE) {
+	memcpy(recvbuf, sendbuf, length);
+    }
+    if (length == 0 || commtab->size == 1) {
+	return progress_isched(sched, request);
+    }
+
+    tmp = (char *) sched_scratch(sched, length);
+    if (!hier_enabled) {
+	__world_group(&world);
+	__sched_allreduce(sched, &world, (char *) recvbuf, tmp, count, esize,
+			  kernel, tag);
+	return progress_isched(sched, request);
+    }
+
+    __sched_reduce_binomial(sched, &local_group, (char *) recvbuf, tmp,
+			    count, esize, kernel, 0, tag);
+    sched_fence(sched);
+    if (local_group.index == 0) {
+	__sched_allreduce(sched, &leader_group, (char *) recvbuf, tmp, count,
+			  esize, kernel, tag);
+	sched_fence(sched);
+    }
+    __sched_bcast(sched, &local_group, (char *) recvbuf, length, 0, tag);
+    return progress_isched(sched, request);
+}
+
+/**
+ * This function is MPI_Iallreduce waited for.
+ */
+int MPI_Allreduce(void *sendbuf, void *recvbuf, int count,
+		  MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    MPI_Request request;
+    int ret = MPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, comm,
+			     &request);
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/**
+ * This function starts a barrier which completes once all processors
+ * have started it. On a single node it uses the dissemination algorithm,
+ * in which no processor is a bottleneck. Across several nodes processors
+ * of a node first check in with their leader, leaders run dissemination
+ * among themselves and then release the processors of their node.
+ */
+int MPI_Ibarrier(MPI_Comm comm, MPI_Request * request)
+{
+    int ret = __check_coll_args(0, MPI_CHAR, 0);
+    struct coll_group world;
+    struct sched *sched;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    tag = __coll_tag(COLL_TAG_BARRIER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (!hier_enabled) {
+	__world_group(&world);
+	__sched_barrier_dissemination(sched, &world, tag);
+	return progress_isched(sched, request);
+    }
+
+    //fan in and out of empty messages, nothing to combine
+    __sched_reduce_binomial(sched, &local_group, NULL, NULL, 0, 0, NULL, 0,
+			    tag);
+    if (local_group.index == 0) {
+	sched_fence(sched);
+	__sched_barrier_dissemination(sched, &leader_group, tag);
+    }
+    sched_fence(sched);
+    __sched_bcast_binomial(sched, &local_group, NULL, 0, 0, tag);
+    return progress_isched(sched, request);
+}
+
+/**
+ * This function is MPI_Ibarrier waited for.
+ */
+int MPI_Barrier(MPI_Comm comm)
+{
+    MPI_Request request;
+    int ret = MPI_Ibarrier(comm, &request);
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/**
+ * This function starts broadcasting message of root to all processors.
+ * Across several nodes the message spreads within the node of root, whose
+ * leader broadcasts it among the leaders, which in turn broadcast it
+ * within their nodes, so every node is reached over the network once.
+ */
+int MPI_Ibcast(void *buff, int count, MPI_Datatype datatype, int root,
+	       MPI_Comm comm, MPI_Request * request)
+{
+    int ret = __check_coll_args(count, datatype, root);
+    struct coll_group world;
+    struct sched *sched;
+    unsigned int length;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    length = datatype_mappings[datatype].size * count;
+    tag = __coll_tag(COLL_TAG_BCAST);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+    if (commtab->size == 1 || length == 0) {
+	return progress_isched(sched, request);
+    }
+
+    if (!hier_enabled) {
+	__world_group(&world);
+	__sched_bcast(sched, &world, (char *) buff, length, root, tag);
+	return progress_isched(sched, request);
+    }
+
+    //root's node spreads the message from root, its leader passes it on
+    if (node_of[root] == leader_group.index) {
+	__sched_bcast(sched, &local_group, (char *) buff, length,
+		      __local_index(root), tag);
+	if (local_group.index == 0) {
+	    sched_fence(sched);
+	    __sched_bcast(sched, &leader_group, (char *) buff, length,
+			  node_of[root], tag);
+	}
+    } else {
+	if (local_group.index == 0) {
+	    __sched_bcast(sched, &leader_group, (char *) buff, length,
+			  node_of[root], tag);
+	    sched_fence(sched);
+	}
+	__sched_bcast(sched, &local_group, (char *) buff, length, 0, tag);
+    }
+    return progress_isched(sched, request);
+}
+
+/**
+ * This function is MPI_Ibcast waited for.
+ */
+int MPI_Bcast(void *buff, int count, MPI_Datatype datatype, int root,
+	      MPI_Comm comm)
+{
+    MPI_Request request;
+    int ret = MPI_Ibcast(buff, count, datatype, root, comm, &request);
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/*
+ * Checks per processor counts and displacements of a vector variant at
+ * root.
+ */
+static int __check_vector_args(const int *counts, const int *displs)
+{
+    int i;
+
+    if (!counts || !displs) {
+	return MPI_ERR_COUNT;
+    }
+    for (i = 0; i < commtab->size; i++) {
+	if (counts[i] < 0 || displs[i] < 0) {
+	    return MPI_ERR_COUNT;
+	}
+    }
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function collects equal blocks of all processors at root in rank
+ * order. Small blocks are latency bound and take the binomial tree, large
+ * ones are received by root straight into their place.
+ */
+int MPI_Gather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+	       void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+	       MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, MPI_CHAR, root);
+    struct sched *sched;
+    int is_root;
+    unsigned int sendlen = 0;
+    unsigned int block;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    is_root = commtab->rank == root;
+    if (sendbuf == MPI_IN_PLACE) {
+	if (!is_root) {
+	    return MPI_ERR_OTHER;
+	}
+    } else {
+	if ((ret = __check_coll_args(sendcount, sendtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	sendlen = datatype_mappings[sendtype].size * sendcount;
+    }
+    block = sendlen;
+    if (is_root) {
+	if ((ret = __check_coll_args(recvcount, recvtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	block = datatype_mappings[recvtype].size * recvcount;
+	//all the blocks must be the same size for the tree
+	if (sendbuf != MPI_IN_PLACE && sendlen != block) {
+	    return MPI_ERR_COUNT;
+	}
+    }
+    if (block == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_GATHER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (block <= GATHER_LONG_BLOCK && commtab->size > 1) {
+	__sched_gather_binomial(sched, sendbuf, (char *) recvbuf, block, root,
+				tag);
+    } else {
+	__sched_gatherv_linear(sched, sendbuf, block, (char *) recvbuf, NULL,
+			       NULL, 1, root, tag);
+    }
+    return __sched_run(sched);
+}
+
+/**
+ * This function collects blocks of varying size of all processors at
+ * root, each at its own displacement. Only root knows the sizes, so
+ * blocks cannot be forwarded through other processors and every one is
+ * received by root straight into its place.
+ */
+int MPI_Gatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+		void *recvbuf, int *recvcounts, int *displs,
+		MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, MPI_CHAR, root);
+    struct sched *sched;
+    int is_root;
+    unsigned int sendlen = 0;
+    int tag;
+    int err;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    is_root = commtab->rank == root;
+    if (sendbuf == MPI_IN_PLACE) {
+	if (!is_root) {
+	    return MPI_ERR_OTHER;
+	}
+    } else {
+	if ((ret = __check_coll_args(sendcount, sendtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	sendlen = datatype_mappings[sendtype].size * sendcount;
+    }
+    if (is_root) {
+	if ((ret = __check_coll_args(0, recvtype, root)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	if ((ret = __check_vector_args(recvcounts, displs)) != MPI_SUCCESS) {
+	    return ret;
+	}
+    }
+    tag = __coll_tag(COLL_TAG_GATHER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    ret = __sched_gatherv_linear(sched, sendbuf, sendlen, (char *) recvbuf,
+				 recvcounts, displs, is_root ?
+				 datatype_mappings[recvtype].size : 1, root, tag);
+    err = __sched_run(sched);
+    return err != MPI_SUCCESS ? err : ret;
+}
+
+/**
+ * This function hands every processor its block of the buffer of root in
+ * rank order. Small blocks take the binomial tree, large ones are sent by
+ * root straight from their place.
+ */
+int MPI_Scatter(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+		void *recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+		MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, MPI_CHAR, root);
+    struct sched *sched;
+    int is_root;
+    unsigned int recvlen = 0;
+    unsigned int block;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    is_root = commtab->rank == root;
+    if (recvbuf == MPI_IN_PLACE) {
+	if (!is_root) {
+	    return MPI_ERR_OTHER;
+	}
+    } else {
+	if ((ret = __check_coll_args(recvcount, recvtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	recvlen = datatype_mappings[recvtype].size * recvcount;
+    }
+    block = recvlen;
+    if (is_root) {
+	if ((ret = __check_coll_args(sendcount, sendtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	block = datatype_mappings[sendtype].size * sendcount;
+	//all the blocks must be the same size for the tree
+	if (recvbuf != MPI_IN_PLACE && recvlen != block) {
+	    return MPI_ERR_COUNT;
+	}
+    }
+    if (block == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_SCATTER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (block <= GATHER_LONG_BLOCK && commtab->size > 1) {
+	__sched_scatter_binomial(sched, (char *) sendbuf, recvbuf, block, root,
+				 tag);
+    } else {
+	__sched_scatterv_linear(sched, (char *) sendbuf, NULL, NULL, 1, recvbuf,
+				block, root, tag);
+    }
+    return __sched_run(sched);
+}
+
+/**
+ * This function hands every processor its block of varying size from its
+ * own displacement in the buffer of root. Root sends every block straight
+ * from its place.
+ */
+int MPI_Scatterv(void *sendbuf, int *sendcounts, int *displs,
+		 MPI_Datatype sendtype, void *recvbuf, int recvcount,
+		 MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, MPI_CHAR, root);
+    struct sched *sched;
+    int is_root;
+    unsigned int recvlen = 0;
+    int tag;
+    int err;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    is_root = commtab->rank == root;
+    if (recvbuf == MPI_IN_PLACE) {
+	if (!is_root) {
+	    return MPI_ERR_OTHER;
+	}
+    } else {
+	if ((ret = __check_coll_args(recvcount, recvtype, root)) !=
+	    MPI_SUCCESS) {
+	    return ret;
+	}
+	recvlen = datatype_mappings[recvtype].size * recvcount;
+    }
+    if (is_root) {
+	if ((ret = __check_coll_args(0, sendtype, root)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	if ((ret = __check_vector_args(sendcounts, displs)) != MPI_SUCCESS) {
+	    return ret;
+	}
+    }
+    tag = __coll_tag(COLL_TAG_SCATTER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    ret = __sched_scatterv_linear(sched, (char *) sendbuf, sendcounts, displs,
+				  is_root ? datatype_mappings[sendtype].size :
+				  1, recvbuf, recvlen, root, tag);
+    err = __sched_run(sched);
+    return err != MPI_SUCCESS ? err : ret;
+}
+
+/**
+ * This function sends a distinct block to every processor and receives
+ * one from each. Short blocks are latency bound and take the Bruck
+ * algorithm with log2(size) messages per processor, longer ones are
+ * exchanged pairwise so that each block is sent exactly once.
+ */
+int MPI_Alltoall(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+		 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+		 MPI_Comm comm)
+{
+    int ret = __check_coll_args(recvcount, recvtype, 0);
+    struct sched *sched;
+    unsigned int block;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    block = datatype_mappings[recvtype].size * recvcount;
+    if (sendbuf != MPI_IN_PLACE) {
+	if ((ret = __check_coll_args(sendcount, sendtype, 0)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	if (datatype_mappings[sendtype].size * sendcount != block) {
+	    return MPI_ERR_COUNT;
+	}
+    }
+    if (block == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_ALLTOALL);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (block <= ALLTOALL_SHORT_BLOCK && commtab->size > 2) {
+	//rotation into scratch lets Bruck read and write recvbuf
+	__sched_alltoall_bruck(sched, sendbuf == MPI_IN_PLACE ?
+			       (char *) recvbuf : (char *) sendbuf,
+			       (char *) recvbuf, block, tag);
+	return __sched_run(sched);
+    }
+    if (sendbuf == MPI_IN_PLACE) {
+	sendbuf = sched_scratch(sched, commtab->size * block);
+	sched_copy(sched, sendbuf, recvbuf, commtab->size * block);
+    }
+    __sched_alltoallv_pairwise(sched, (char *) sendbuf, NULL, NULL, block,
+			       (char *) recvbuf, NULL, NULL, block, tag);
+    return __sched_run(sched);
+}
+
+/**
+ * This function sends a block of varying size to every processor and
+ * receives one from each, every block at its own displacement. Blocks are
+ * exchanged pairwise straight between user buffers.
+ */
+int MPI_Alltoallv(void *sendbuf, int *sendcounts, int *sdispls,
+		  MPI_Datatype sendtype, void *recvbuf, int *recvcounts,
+		  int *rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, recvtype, 0);
+    struct sched *sched;
+    unsigned int extent = 0;
+    unsigned int offset, len;
+    int tag;
+    int err;
+    int i;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_vector_args(recvcounts, rdispls)) != MPI_SUCCESS) {
+	return ret;
+    }
+    if (sendbuf != MPI_IN_PLACE) {
+	if ((ret = __check_coll_args(0, sendtype, 0)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	if ((ret = __check_vector_args(sendcounts, sdispls)) != MPI_SUCCESS) {
+	    return ret;
+	}
+    }
+    tag = __coll_tag(COLL_TAG_ALLTOALL);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (sendbuf == MPI_IN_PLACE) {
+	//blocks are sent from a copy of recvbuf laid out as received
+	for (i = 0; i < commtab->size; i++) {
+	    __vblock(recvcounts, rdispls, datatype_mappings[recvtype].size, i,
+		     &offset, &len);
+	    if (offset + len > extent) {
+		extent = offset + len;
+	    }
+	}
+	sendbuf = sched_scratch(sched, extent);
+	sched_copy(sched, sendbuf, recvbuf, extent);
+	sendcounts = recvcounts;
+	sdispls = rdispls;
+	sendtype = recvtype;
+    }
+
+    ret = __sched_alltoallv_pairwise(sched, (char *) sendbuf, sendcounts,
+				     sdispls, datatype_mappings[sendtype].size,
+				     (char *) recvbuf, recvcounts, rdispls,
+				     datatype_mappings[recvtype].size, tag);
+    err = __sched_run(sched);
+    return err != MPI_SUCCESS ? err : ret;
+}
+
+/**
+ * This function collects equal blocks of all processors at every
+ * processor in rank order. Short messages on a power of two processors
+ * take recursive doubling and on any other number Bruck, both in
+ * ceil(log2(size)) rounds. Long messages go around the ring, which moves
+ * every block over each link once.
+ */
+int MPI_Allgather(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+		  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+		  MPI_Comm comm)
+{
+    int ret = __check_coll_args(recvcount, recvtype, 0);
+    struct coll_group world;
+    struct sched *sched;
+    int size;
+    unsigned int block;
+    unsigned int total;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    size = commtab->size;
+    block = datatype_mappings[recvtype].size * recvcount;
+    if (sendbuf != MPI_IN_PLACE) {
+	if ((ret = __check_coll_args(sendcount, sendtype, 0)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	if (datatype_mappings[sendtype].size * sendcount != block) {
+	    return MPI_ERR_COUNT;
+	}
+	memcpy((char *) recvbuf + commtab->rank * block, sendbuf, block);
+    }
+    total = block * size;
+    if (size == 1 || block == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_ALLGATHER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if ((size & (size - 1)) == 0 && total <= ALLGATHER_LONG_MSG) {
+	__sched_allgather_recursive_doubling(sched, (char *) recvbuf, block,
+					     tag);
+    } else if (total <= ALLGATHER_SHORT_MSG) {
+	__sched_allgatherv_bruck(sched, (char *) recvbuf, NULL, NULL, block,
+				 tag);
+    } else {
+	//equal blocks are what __block_range cuts the whole buffer into
+	__world_group(&world);
+	__sched_allgather_ring(sched, &world, (char *) recvbuf, NULL, NULL,
+			       total, 1, 0, tag);
+    }
+    return __sched_run(sched);
+}
+
+/**
+ * This function collects blocks of varying size of all processors at
+ * every processor, each at its own displacement. Short messages take
+ * Bruck and long ones go around the ring.
+ */
+int MPI_Allgatherv(void *sendbuf, int sendcount, MPI_Datatype sendtype,
+		   void *recvbuf, int *recvcounts, int *displs,
+		   MPI_Datatype recvtype, MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, recvtype, 0);
+    struct coll_group world;
+    struct sched *sched;
+    int esize;
+    unsigned int sendlen;
+    unsigned int total = 0;
+    int tag;
+    int i;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_vector_args(recvcounts, displs)) != MPI_SUCCESS) {
+	return ret;
+    }
+    esize = datatype_mappings[recvtype].size;
+    if (sendbuf != MPI_IN_PLACE) {
+	if ((ret = __check_coll_args(sendcount, sendtype, 0)) != MPI_SUCCESS) {
+	    return ret;
+	}
+	sendlen = datatype_mappings[sendtype].size * sendcount;
+	if (sendlen > recvcounts[commtab->rank] * esize) {
+	    return MPI_ERR_TRUNCATE;
+	}
+	memcpy((char *) recvbuf + displs[commtab->rank] * esize, sendbuf,
+	       sendlen);
+    }
+    for (i = 0; i < commtab->size; i++) {
+	total += recvcounts[i] * esize;
+    }
+    if (commtab->size == 1 || total == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_ALLGATHER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (total <= ALLGATHER_SHORT_MSG) {
+	__sched_allgatherv_bruck(sched, (char *) recvbuf, recvcounts, displs,
+				 esize, tag);
+    } else {
+	__world_group(&world);
+	__sched_allgather_ring(sched, &world, (char *) recvbuf, recvcounts,
+			       displs, 0, esize, 0, tag);
+    }
+    return __sched_run(sched);
+}
+
+/*
+ * Performs an inclusive or exclusive prefix reduction for MPI_Scan and
+ * MPI_Exscan.
+ */
+static int __scan(void *sendbuf, void *recvbuf, int count,
+		  MPI_Datatype datatype, MPI_Op op, int inclusive)
+{
+    int ret = __check_coll_args(count, datatype, 0);
+    struct sched *sched;
+    op_kernel_t kernel;
+    unsigned int length;
+    char *partial;
+    int tag;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_op(datatype, op, &kernel)) != MPI_SUCCESS) {
+	return ret;
+    }
+    length = datatype_mappings[datatype].size * count;
+    if (length == 0) {
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_SCAN);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    //partial reduction of own group followed by scratch for partner's
+    partial = (char *) sched_scratch(sched, length * 2);
+    if (!partial) {
+	sched_free(sched);
+	return MPI_ERR_OTHER;
+    }
+    sched_copy(sched, partial, sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf,
+	       length);
+    if (inclusive && sendbuf != MPI_IN_PLACE) {
+	sched_copy(sched, recvbuf, sendbuf, length);
+    }
+
+    __sched_scan_recursive_doubling(sched, partial, (char *) recvbuf,
+				    partial + length, count,
+				    datatype_mappings[datatype].size, kernel,
+				    inclusive, tag);
+    return __sched_run(sched);
+}
+
+/**
+ * This function leaves at every processor the reduction of the vectors of
+ * all processors up to and including itself. It uses recursive doubling,
+ * which takes ceil(log2(size)) rounds.
+ */
+int MPI_Scan(void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype,
+	     MPI_Op op, MPI_Comm comm)
+{
+    return __scan(sendbuf, recvbuf, count, datatype, op, TRUE);
+}
+
+/**
+ * This function leaves at every processor the reduction of the vectors of
+ * all processors below itself. Receive buffer of rank 0 is left untouched.
+ */
+int MPI_Exscan(void *sendbuf, void *recvbuf, int count,
+	       MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    return __scan(sendbuf, recvbuf, count, datatype, op, FALSE);
+}
+
+/**
+ * This function combines vectors of all processors element by element and
+ * hands processor i the recvcounts[i] elements of the result following
+ * those of the processors below. It uses recursive halving, which takes
+ * log2 rounds and sends half as much data every round.
+ */
+int MPI_Reduce_scatter(void *sendbuf, void *recvbuf, int *recvcounts,
+		       MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    int ret = __check_coll_args(0, datatype, 0);
+    struct sched *sched;
+    int esize;
+    op_kernel_t kernel;
+    unsigned int length = 0;
+    int tag;
+    int i;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if ((ret = __check_op(datatype, op, &kernel)) != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!recvcounts) {
+	return MPI_ERR_COUNT;
+    }
+    esize = datatype_mappings[datatype].size;
+    for (i = 0; i < commtab->size; i++) {
+	if (recvcounts[i] < 0) {
+	    return MPI_ERR_COUNT;
+	}
+	length += recvcounts[i] * esize;
+    }
+    if (length == 0) {
+	return MPI_SUCCESS;
+    }
+    if (commtab->size == 1) {
+	if (sendbuf != MPI_IN_PLACE) {
+	    memcpy(recvbuf, sendbuf, length);
+	}
+	return MPI_SUCCESS;
+    }
+    tag = __coll_tag(COLL_TAG_REDUCE_SCATTER);
+    if (!(sched = sched_create())) {
+	return MPI_ERR_OTHER;
+    }
+
+    __sched_reduce_scatter_halving(sched, sendbuf, (char *) recvbuf,
+				   recvcounts, esize, kernel, tag);
+    return __sched_run(sched);
+}
+
+/**
+ * This function is MPI_Reduce_scatter with recvcount elements of the
+ * result for every processor.
+ */
+int MPI_Reduce_scatter_block(void *sendbuf, void *recvbuf, int recvcount,
+			     MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    int ret = __check_coll_args(recvcount, datatype, 0);
+    int *recvcounts;
+    int i;
+
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    recvcounts = (int *) malloc(sizeof(int) * commtab->size);
+    if (!recvcounts) {
+	dprintf("Failed to allocate reduce scatter counts\n");
+	return MPI_ERR_OTHER;
+    }
+    for (i = 0; i < commtab->size; i++) {
+	recvcounts[i] = recvcount;
+    }
+    ret = MPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op,
+			     comm);
+    free(recvcounts);
+    return ret;
+}
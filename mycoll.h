@@ -0,0 +1,78 @@
+/**
+ * This header defines internals shared by collective operations.
+ *
+ * Collectives are built on the point-to-point layer. Their messages carry
+ * tags above MPI_TAG_UB, which the application can neither send nor
+ * receive with MPI_ANY_TAG, so they never mix with application messages.
+ * Every collective runs from a schedule and schedules of non-blocking
+ * collectives may overlap, so tags carry the sequence number of the
+ * operation as well, which every processor counts alike.
+ */
+#ifndef __MY_COLL_H
+#define __MY_COLL_H
+
+#include "mympi.h"
+#include "myop.h"
+
+/*Tags of collective operations*/
+#define COLL_TAG_BASE        (MPI_TAG_UB + 1)
+#define COLL_TAG_BCAST       (COLL_TAG_BASE + 0)
+#define COLL_TAG_REDUCE      (COLL_TAG_BASE + 1)
+#define COLL_TAG_ALLREDUCE   (COLL_TAG_BASE + 2)
+#define COLL_TAG_BARRIER     (COLL_TAG_BASE + 3)
+#define COLL_TAG_GATHER      (COLL_TAG_BASE + 4)
+#define COLL_TAG_SCATTER     (COLL_TAG_BASE + 5)
+#define COLL_TAG_ALLTOALL    (COLL_TAG_BASE + 6)
+#define COLL_TAG_ALLGATHER   (COLL_TAG_BASE + 7)
+#define COLL_TAG_SCAN        (COLL_TAG_BASE + 8)
+#define COLL_TAG_REDUCE_SCATTER (COLL_TAG_BASE + 9)
+#define COLL_TAG_TABLE       (COLL_TAG_BASE + 10)	/*address table in MPI_Init */
+
+/*Tag of a scheduled collective with sequence number seq. The low four
+ *bits keep the operation, so tags of different operations never meet*/
+#define COLL_TAG_SEQ(tag, seq) ((tag) + (int) (((seq) & 0x3ffffff) << 4))
+
+/*Environment variable which turns node aware collectives off with "0"*/
+#define COLL_HIER_ENV        "MYMPI_HIER"
+
+/*Communicator table defined in mympi.c*/
+extern struct _MPI_Comm *commtab;
+
+/*
+ * This function validates arguments common to collective operations.
+ * It is implemented in mympi.c.
+ * Return value
+ *     MPI_SUCCESS or the MPI error code of the invalid argument
+ */
+int __check_coll_args(int /*count */ , MPI_Datatype /*datatype */ ,
+		      int /*root */ );
+
+/*
+ * These functions start sending and receiving length bytes of a
+ * collective operation with tag to and from peer. They are implemented in
+ * mympi.c.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __coll_isend(void * /*buff */ , unsigned int /*length */ ,
+		 int /*peer */ , int /*tag */ , MPI_Request * /*request */ );
+int __coll_irecv(void * /*buff */ , unsigned int /*length */ ,
+		 int /*peer */ , int /*tag */ , MPI_Request * /*request */ );
+
+/*
+ * This function groups processors by node for collective operations.
+ * Processors sharing an address share a node and the lowest rank of a node
+ * leads it. Broadcast, allreduce and barrier then run in phases within
+ * nodes and among leaders. It is called once connection table is
+ * populated.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int coll_init(void);
+
+/*
+ * This function releases the layout built by coll_init.
+ */
+void coll_finalize(void);
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * Implementation of message matching queues.
+ *
+ * Unexpected messages are linked twice: into a hash bucket keyed by
+ * (source, tag) and into a list in arrival order. Receives naming both
+ * source and tag look in their bucket only, which keeps the common case
+ * O(1). Wildcard receives walk the arrival list so that the earliest
+ * matching message is always delivered first.
+ */
+#include "mymatch.h"
+#include "mympi.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*Number of unexpected queue hash buckets, must be power of two*/
+#define MATCH_HASH_BUCKETS 256
+
+/*Unexpected message entry*/
+struct unexpected_msg {
+    int source;			/*rank of sending processor */
+    int tag;			/*message tag */
+    msg_t *msg;			/*message including payload */
+    struct unexpected_msg *bucket_prev;	/*hash bucket links */
+    struct unexpected_msg *bucket_next;
+    struct unexpected_msg *arrival_prev;	/*arrival order links */
+    struct unexpected_msg *arrival_next;
+};
+
+/*Doubly linked list head and tail*/
+struct unexpected_list {
+    struct unexpected_msg *head;
+    struct unexpected_msg *tail;
+};
+
+struct match_engine {
+    struct posted_recv *posted_head;	/*posted receives in post order */
+    struct posted_recv *posted_tail;
+    struct unexpected_list buckets[MATCH_HASH_BUCKETS];
+    struct unexpected_list arrivals;	/*unexpected messages by arrival */
+    struct unexpected_msg *free_entries;	/*recycled entries */
+};
+
+/*
+ * Hash of (source, tag) pair.
+ */
+static inline unsigned int __match_hash(int source, int tag)
+{
+    unsigned int hash = (unsigned int) source * 2654435761u;
+    hash ^= (unsigned int) tag * 40503u;
+    return (hash ^ (hash >> 16)) & (MATCH_HASH_BUCKETS - 1);
+}
+
+/*
+ * Checks if a receive for (source, tag) accepts message from msg_source
+ * with msg_tag. Wildcard tag never matches tags of collectives.
+ */
+static inline int __match(int source, int tag, int msg_source, int msg_tag)
+{
+    return (source == MPI_ANY_SOURCE || source == msg_source)
+	&& (tag == MPI_ANY_TAG ? (unsigned int) msg_tag <= MPI_TAG_UB :
+	    tag == msg_tag);
+}
+
+struct match_engine *match_engine_create(void)
+{
+    struct match_engine *engine =
+	(struct match_engine *) malloc(sizeof(struct match_engine));
+    if (!engine) {
+	return NULL;
+    }
+    memset(engine, 0, sizeof(struct match_engine));
+    return engine;
+}
+
+void match_engine_destroy(struct match_engine *engine)
+{
+    struct unexpected_msg *entry;
+
+    if (!engine) {
+	return;
+    }
+    while ((entry = engine->arrivals.head) != NULL) {
+	engine->arrivals.head = entry->arrival_next;
+	dprintf("Dropping unmatched message from rank:%d tag:%d\n",
+		entry->source, entry->tag);
+	release_msg(entry->msg);
+	free(entry);
+    }
+    while ((entry = engine->free_entries) != NULL) {
+	engine->free_entries = entry->arrival_next;
+	free(entry);
+    }
+    free(engine);
+}
+
+void match_post_recv(struct match_engine *engine,
+		     struct posted_recv *posted)
+{
+    posted->next = NULL;
+    if (engine->posted_tail) {
+	engine->posted_tail->next = posted;
+    } else {
+	engine->posted_head = posted;
+    }
+    engine->posted_tail = posted;
+}
+
+void match_cancel_recv(struct match_engine *engine,
+		       struct posted_recv *posted)
+{
+    struct posted_recv *prev = NULL;
+    struct posted_recv *curr = engine->posted_head;
+
+    while (curr && curr != posted) {
+	prev = curr;
+	curr = curr->next;
+    }
+    if (!curr) {
+	return;
+    }
+    //unlink
+    if (prev) {
+	prev->next = curr->next;
+    } else {
+	engine->posted_head = curr->next;
+    }
+    if (engine->posted_tail == curr) {
+	engine->posted_tail = prev;
+    }
+    curr->next = NULL;
+}
+
+struct posted_recv *match_take_posted(struct match_engine *engine,
+				      int source, int tag)
+{
+    struct posted_recv *curr;
+
+    //receives are matched in the order they were posted
+    for (curr = engine->posted_head; curr; curr = curr->next) {
+	if (__match(curr->source, curr->tag, source, tag)) {
+	    match_cancel_recv(engine, curr);
+	    return curr;
+	}
+    }
+    return NULL;
+}
+
+struct posted_recv *match_take_posted_from(struct match_engine *engine,
+					   int source)
+{
+    struct posted_recv *curr;
+
+    for (curr = engine->posted_head; curr; curr = curr->next) {
+	if (curr->source == source) {
+	    match_cancel_recv(engine, curr);
+	    return curr;
+	}
+    }
+    return NULL;
+}
+
+int match_add_unexpected(struct match_engine *engine, int source,
+			 msg_t * msg)
+{
+    struct unexpected_msg *entry = engine->free_entries;
+
+    if (entry) {
+	engine->free_entries = entry->arrival_next;
+    } else {
+	entry = (struct unexpected_msg *)
+	    malloc(sizeof(struct unexpected_msg));
+	if (!entry) {
+	    return MSG_ERROR;
+	}
+    }
+    entry->source = source;
+    entry->tag = msg->data.tag;
+    entry->msg = msg;
+
+    //append to hash bucket
+    struct unexpected_list *bucket =
+	&engine->buckets[__match_hash(source, entry->tag)];
+    entry->bucket_next = NULL;
+    entry->bucket_prev = bucket->tail;
+    if (bucket->tail) {
+	bucket->tail->bucket_next = entry;
+    } else {
+	bucket->head = entry;
+    }
+    bucket->tail = entry;
+
+    //append to arrival order list
+    entry->arrival_next = NULL;
+    entry->arrival_prev = engine->arrivals.tail;
+    if (engine->arrivals.tail) {
+	engine->arrivals.tail->arrival_next = entry;
+    } else {
+	engine->arrivals.head = entry;
+    }
+    engine->arrivals.tail = entry;
+
+    return MSG_SUCCESS;
+}
+
+/*
+ * Unlinks entry from both lists and recycles it.
+ */
+static void __remove_unexpected(struct match_engine *engine,
+				struct unexpected_msg *entry)
+{
+    struct unexpected_list *bucket =
+	&engine->buckets[__match_hash(entry->source, entry->tag)];
+
+    if (entry->bucket_prev) {
+	entry->bucket_prev->bucket_next = entry->bucket_next;
+    } else {
+	bucket->head = entry->bucket_next;
+    }
+    if (entry->bucket_next) {
+	entry->bucket_next->bucket_prev = entry->bucket_prev;
+    } else {
+	bucket->tail = entry->bucket_prev;
+    }
+
+    if (entry->arrival_prev) {
+	entry->arrival_prev->arrival_next = entry->arrival_next;
+    } else {
+	engine->arrivals.head = entry->arrival_next;
+    }
+    if (entry->arrival_next) {
+	entry->arrival_next->arrival_prev = entry->arrival_prev;
+    } else {
+	engine->arrivals.tail = entry->arrival_prev;
+    }
+
+    entry->arrival_next = engine->free_entries;
+    engine->free_entries = entry;
+}
+
+msg_t *match_take_unexpected(struct match_engine *engine, int source,
+			     int tag, int *msg_source)
+{
+    struct unexpected_msg *entry;
+
+    if (source != MPI_ANY_SOURCE && tag != MPI_ANY_TAG) {
+	//exact match, only one bucket has to be searched
+	entry = engine->buckets[__match_hash(source, tag)].head;
+	while (entry && (entry->source != source || entry->tag != tag)) {
+	    entry = entry->bucket_next;
+	}
+    } else {
+	//wildcard, earliest arrival wins
+	entry = engine->arrivals.head;
+	while (entry && !__match(source, tag, entry->source, entry->tag)) {
+	    entry = entry->arrival_next;
+	}
+    }
+    if (!entry) {
+	return NULL;
+    }
+
+    msg_t *msg = entry->msg;
+    if (msg_source) {
+	*msg_source = entry->source;
+    }
+    __remove_unexpected(engine, entry);
+    return msg;
+}
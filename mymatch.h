@@ -0,0 +1,98 @@
+/**
+ * This header defines message matching queues used by receive operations.
+ *
+ * Every arrived message is matched by (source, tag) against receives
+ * posted by the application in the order they were posted. Messages for
+ * which no receive is posted yet are kept in the unexpected message queue
+ * till a matching receive is posted.
+ */
+#ifndef __MY_MATCH_H
+#define __MY_MATCH_H
+
+#include "mymsg.h"
+
+/*Posted receive waiting for a message*/
+struct posted_recv {
+    int source;			/*source rank or MPI_ANY_SOURCE */
+    int tag;			/*tag or MPI_ANY_TAG */
+    void *req;			/*receive request owning this entry */
+    struct posted_recv *next;	/*next posted receive in post order */
+};
+
+/*Matching queues of a communicator*/
+struct match_engine;
+
+/*
+ * This function creates empty matching queues.
+ * Return value
+ *     matching queues or NULL on allocation failure
+ */
+struct match_engine *match_engine_create(void);
+
+/*
+ * This function destroys matching queues and releases all messages still
+ * waiting in unexpected message queue.
+ */
+void match_engine_destroy(struct match_engine * /*engine */ );
+
+/*
+ * This function appends receive to the posted receive queue. The entry is
+ * owned by the caller and must stay valid till it is matched or cancelled.
+ */
+void match_post_recv(struct match_engine * /*engine */ ,
+		     struct posted_recv * /*posted */ );
+
+/*
+ * This function removes receive from the posted receive queue.
+ */
+void match_cancel_recv(struct match_engine * /*engine */ ,
+		       struct posted_recv * /*posted */ );
+
+/*
+ * This function finds the first posted receive matching an arrived
+ * message and removes it from the posted receive queue.
+ * Input parameters
+ *      source  rank of sending processor
+ *      tag     message tag
+ * Return value
+ *      matching posted receive or NULL if none matches
+ */
+struct posted_recv *match_take_posted(struct match_engine * /*engine */ ,
+				      int /*source */ , int /*tag */ );
+
+/*
+ * This function finds the first posted receive naming source explicitly
+ * and removes it from the posted receive queue. Receives from any source
+ * are left alone.
+ * Return value
+ *      posted receive or NULL if none names source
+ */
+struct posted_recv *match_take_posted_from(struct match_engine * /*engine */ ,
+					   int /*source */ );
+
+/*
+ * This function appends arrived message to the unexpected message queue.
+ * Queue takes ownership of the message.
+ * Return value
+ *      MSG_SUCCESS on success or MSG_ERROR on allocation failure
+ */
+int match_add_unexpected(struct match_engine * /*engine */ ,
+			 int /*source */ , msg_t * /*msg */ );
+
+/*
+ * This function finds the earliest unexpected message matching a receive
+ * and removes it from the queue. Ownership of the message passes to the
+ * caller.
+ * Input parameters
+ *      source  source rank or MPI_ANY_SOURCE
+ *      tag     tag or MPI_ANY_TAG
+ * Output parameters
+ *      msg_source  rank of processor which sent the message
+ * Return value
+ *      matching message or NULL if none matches
+ */
+msg_t *match_take_unexpected(struct match_engine * /*engine */ ,
+			     int /*source */ , int /*tag */ ,
+			     int * /*msg_source */ );
+
+#endif
@@ -1,5 +1,10 @@
 #include "mympi.h"
 #include "mymsg.h"
+#include "mymatch.h"
+#include "myprogress.h"
+#include "myshm.h"
+#include "mycoll.h"
+#include "myop.h"
 #include "debug.h"
 
 #include <unistd.h>
@@ -11,17 +16,35 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 
 #include <sys/time.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 /*Define boolean values*/
 #define FALSE              0
 #define TRUE               1
 
-/*Pending connections queue length*/
-#define PENDING_CONNECTIONS_QUEUE_LENGTH 100
+/*Pending connections queue length, all processors register with root at
+ *once so it is as long as the system allows*/
+#define PENDING_CONNECTIONS_QUEUE_LENGTH SOMAXCONN
+
+/*Events handled per wait while root reads registrations*/
+#define BOOTSTRAP_EVENTS     64
+
+/*Connecting to root is retried with delays doubling from the first to the
+ *last one in microseconds, for at most MYMPI_CONNECT_TIMEOUT seconds*/
+#define CONNECT_RETRY_MIN_US 1000
+#define CONNECT_RETRY_MAX_US 256000
+#define CONNECT_TIMEOUT_ENV  "MYMPI_CONNECT_TIMEOUT"
+#define DEFAULT_CONNECT_TIMEOUT 30
+
+/*Environment variable which prints message pool counters in MPI_Finalize
+ *unless it is "0"*/
+#define POOL_STATS_ENV       "MYMPI_POOL_STATS"
 
 /*Dummy tag used while establishing connection*/
 #define CONNECTION_TAG          0
@@ -45,6 +68,14 @@
 /*Root processor rank*/
 #define ROOT		     0
 
+
+/*Registration of a processor with root, read without blocking*/
+struct registration {
+    int fd;			/*accepted connection or 0 for a free slot */
+    unsigned int got;		/*bytes of hdr read so far */
+    msg_t hdr;			/*MSG_INIT message of the processor */
+};
+
 /*Initialization flag*/
 static int is_initialized = FALSE;
 
@@ -58,61 +89,15 @@ char g_hostname[MPI_MAX_PROCESSOR_NAME];
 int g_rank;
 
 /**
- * Datatype size mappings from MPI_Datatype to C datatypes
+ * Datatype mappings from MPI_Datatype to C datatypes, reduction kernels
+ * are filled in by op_init
  */
-int datatype_mappings[] = {
-    sizeof(char),		/*MPI_CHAR */
-    sizeof(int),		/*MPI_INT */
-    sizeof(double)		/*MPI_DOUBLE */
+struct datatype_mapping datatype_mappings[] = {
+    {sizeof(char)},		/*MPI_CHAR */
+    {sizeof(int)},		/*MPI_INT */
+    {sizeof(double)}		/*MPI_DOUBLE */
 };
 
-/** 
- * This function sends data to file descriptor 
- */
-int __MPI_Send(int fd, void *buff, int length, MPI_Datatype datatype,
-	       int tag)
-{
-    msg_t *pMsg;
-
-    //create message header and add payload data
-    if (create_data_msg
-	(datatype, tag, buff, datatype_mappings[datatype] * length,
-	 &pMsg) != MSG_SUCCESS) {
-	dprintf("failed to create message\n");
-	return MPI_ERR_OTHER;
-    }
-    dprintf("sending message\n");
-    print_msg_hdr(pMsg);
-    //send the data over file descriptor 
-    if (send_msg(fd, pMsg) != MPI_SUCCESS) {
-	return MPI_ERR_OTHER;
-    }
-    //cleanup
-    free_data_msg(pMsg);
-    return MPI_SUCCESS;
-}
-
-/**
- * This function receives data over file descriptor and updates status.
- */
-int __MPI_Recv(int fd, int tag, MPI_Status * status, msg_t ** pMsg)
-{
-    //read message from file descriptor
-    if (read_msg(fd, pMsg) != MSG_SUCCESS) {
-	//update status length to 0
-	if (status) {
-	    status->length = 0;
-	}
-	return MPI_ERR_OTHER;
-    }
-    //update status to length size.
-    if (status) {
-	status->length += (*pMsg)->length;
-    }
-
-    return MPI_SUCCESS;
-}
-
 /**
  * This function parses MPI_Init arguments.
  *
@@ -175,6 +160,40 @@ int __parse_arguments(int *pargc, char ***pargv, char **hostname,
     return MPI_SUCCESS;
 }
 
+/**
+ * This function takes rank and size of a processor started by mpirun
+ * from environment. Arguments are left to the application.
+ *
+ * Output parameters
+ *      rank             rank of the processor
+ *      nr_processor     Total number of processors
+ * Return value
+ * 	MPI_SUCCESS on successful parsing or else MPI_ERR_OTHER
+ */
+int __parse_environment(int *rank, int *nr_processors)
+{
+    char *size = getenv(MYMPI_SIZE_ENV);
+    char *self = getenv(MYMPI_RANK_ENV);
+
+    if (!size || !self) {
+	dprintf("Missing %s or %s\n", MYMPI_SIZE_ENV, MYMPI_RANK_ENV);
+	return MPI_ERR_OTHER;
+    }
+    *nr_processors = atoi(size);
+    *rank = atoi(self);
+    if (*nr_processors < 1 || *rank < 0 || *rank >= *nr_processors) {
+	dprintf("Invalid rank:%d of %d processors\n", *rank,
+		*nr_processors);
+	return MPI_ERR_OTHER;
+    }
+    g_rank = *rank;
+    if (gethostname(g_hostname, MPI_MAX_PROCESSOR_NAME) < 0) {
+	strcpy(g_hostname, "localhost");
+    }
+    g_hostname[MPI_MAX_PROCESSOR_NAME - 1] = '\0';
+    return MPI_SUCCESS;
+}
+
 /**
  * This function initializes global communicator object.
  *
@@ -195,8 +214,12 @@ int __initialize_comm(int nr_processors, int rank)
 	return MPI_ERR_OTHER;
     }
     //initialize
+    memset(commtab, 0, sizeof(struct _MPI_Comm));
     commtab->size = nr_processors;
     commtab->rank = rank;
+    commtab->listen_fd = 0;
+    commtab->connecting = -1;
+    commtab->epfd = -1;
 
     //allocate memory for context table
     commtab->ctable =
@@ -204,353 +227,1303 @@ int __initialize_comm(int nr_processors, int rank)
 					nr_processors);
     if (!commtab->ctable) {
 	dprintf("Failed to create context table\n");
-	free(commtab);
-	return MPI_ERR_OTHER;
+	goto fail;
     }
     memset(commtab->ctable, 0,
 	   sizeof(struct context_table) * nr_processors);
 
+    //create message matching queues
+    commtab->match = match_engine_create();
+    if (!commtab->match) {
+	dprintf("Failed to create matching queues\n");
+	goto fail;
+    }
+
+    //create progress engine
+    commtab->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (commtab->epfd < 0 || progress_init() != MPI_SUCCESS) {
+	dprintf("Failed to create progress engine\n");
+	goto fail;
+    }
+
     return MPI_SUCCESS;
+
+  fail:
+    //every part not created yet is NULL or -1
+    progress_finalize();
+    if (commtab->epfd >= 0) {
+	close(commtab->epfd);
+    }
+    match_engine_destroy(commtab->match);
+    free(commtab->ctable);
+    free(commtab);
+    commtab = NULL;
+    return MPI_ERR_OTHER;
 }
 
 /**
- * This function populates global communicator object for root.
+ * This function opens listening server socket.
  *
  * Input parameters
- * 		root_port 		root server port
+ * 		port 		server port or 0 for ephemeral port
+ * Output parameters
+ * 		listen_fd 	listening socket descriptor
+ * 		bound_port 	port the server is listening on
  * Return value
  * 		MPI_SUCCESS on success else MPI_ERR_OTHER 
  */
-int __populate_root_comm(int root_port, int nr_processors)
+int __create_listener(int port, int *listen_fd, uint16_t * bound_port)
 {
-
-    /*start server wait for connections */
     struct sockaddr_in serv_addr;	//server address
+    socklen_t addr_len = sizeof(serv_addr);
     int sockfd;			//temporary socket descriptor
+    int reuse = 1;
+
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
-	dprintf("Failed to create server socket descriptor:%d\n",
-		root_port);
+	dprintf("Failed to create server socket descriptor:%d\n", port);
 	return MPI_ERR_OTHER;
     }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     memset((char *) &serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(root_port);
+    serv_addr.sin_port = htons(port);
 
     if (bind(sockfd, (struct sockaddr *) &serv_addr,
 	     sizeof(serv_addr)) < 0) {
-	dprintf("Failed to bind to server port:%d\n", root_port);
+	dprintf("Failed to bind to server port:%d\n", port);
+	close(sockfd);
 	return MPI_ERR_OTHER;
     }
 
-    listen(sockfd, PENDING_CONNECTIONS_QUEUE_LENGTH);
-
-    //accept connections from all the other nodes
-    int conn_count = 0;
-    int newsockfd;
-    MPI_Status status;
-    msg_t *pMsg;
-
-    while (conn_count < (nr_processors - 1)) {
-	newsockfd = accept(sockfd, (struct sockaddr *) NULL, 0);
-	if (newsockfd < 0) {
-	    dprintf("failed to accept connection\n");
-	    continue;
-	} else {
-	    //get the rank of the process
-	    if (__MPI_Recv(newsockfd, CONNECTION_TAG, &status, &pMsg)
-		!= MPI_SUCCESS) {
-		dprintf("Failed to read message for new connection\n");
-		continue;
-	    }
-	    print_msg_hdr(pMsg);
-	    if (pMsg->type != MSG_INIT) {
-		dprintf("Expecting MSG_INIT message\n");
-	    }
-
-	    commtab->ctable[pMsg->init.rank].fd = newsockfd;
-	    commtab->ctable[pMsg->init.rank].address = pMsg->init.address;
-	    commtab->ctable[pMsg->init.rank].port = pMsg->init.port;
-	    conn_count++;
-	}
+    if (listen(sockfd, PENDING_CONNECTIONS_QUEUE_LENGTH) < 0) {
+	dprintf("Failed to listen on server port:%d\n", port);
+	close(sockfd);
+	return MPI_ERR_OTHER;
+    }
+    //find out the port actually bound
+    if (getsockname(sockfd, (struct sockaddr *) &serv_addr, &addr_len) <
+	0) {
+	dprintf("Failed to get server port\n");
+	close(sockfd);
+	return MPI_ERR_OTHER;
     }
 
-    //clean up
-    free(pMsg);
-
+    *listen_fd = sockfd;
+    *bound_port = ntohs(serv_addr.sin_port);
     return MPI_SUCCESS;
 }
 
-/** 
- * This function initializes communicator object for non root.
+/**
+ * This function connects to listening server of a processor.
  *
+ * Input parameters
+ * 		address 	ip address in host byte order
+ * 		port 		server port in host byte order
+ * Output parameters
+ * 		fd 		connected socket descriptor
  * Return value
- * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER 
  */
-int __populate_non_root_comm(int rank, char *root_hostname, int root_port)
+int __connect_to(uint32_t address, uint16_t port, int *fd)
 {
-
-    /*connect */
-    int sockfd;
     struct sockaddr_in serv_addr;
-    struct hostent *server;
-    msg_t *pMsg;
+    int sockfd;
+    int nodelay = 1;
 
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
-
     if (sockfd < 0) {
-	dprintf("Failed to opening socket rank:%d\n", rank);
-	return MPI_ERR_OTHER;
-    }
-    server = gethostbyname(root_hostname);
-    if (server == NULL) {
-	dprintf("No such host\n");
+	dprintf("Failed to open socket\n");
 	return MPI_ERR_OTHER;
     }
+    //bootstrap exchanges are small writes answered by the peer
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
     memset((char *) &serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
-    bcopy((char *) server->h_addr,
-	  (char *) &serv_addr.sin_addr.s_addr, server->h_length);
-    serv_addr.sin_port = htons(root_port);
+    serv_addr.sin_addr.s_addr = htonl(address);
+    serv_addr.sin_port = htons(port);
 
-    if ((connect
-	 (sockfd, (struct sockaddr *) &serv_addr,
-	  sizeof(serv_addr))) < 0) {
-	dprintf("Failed to connect to server rank:%d\n", rank);
+    if (connect(sockfd, (struct sockaddr *) &serv_addr,
+		sizeof(serv_addr)) < 0) {
+	dprintf("Failed to connect to %u:%u\n", address, port);
+	close(sockfd);
+	return MPI_ERR_OTHER;
     }
+
+    *fd = sockfd;
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function tells whether a peer may be reached through shared
+ * memory, which is the case when it runs on the same host.
+ */
+int __same_host(int peer)
+{
+    return shm_enabled() && peer != commtab->rank
+	&& commtab->ctable[peer].address ==
+	commtab->ctable[commtab->rank].address;
+}
+
+/**
+ * This function sends MSG_INIT message which registers this processor
+ * rank, address and server port with the peer. flags carry INIT_FLAG_*
+ * connection options offered to or accepted from the peer.
+ */
+int __send_init(int fd, int flags)
+{
+    msg_t *pMsg;
+    struct context_table *self = &commtab->ctable[commtab->rank];
+
     //create init message
-    if (create_init_msg(rank, 0, &pMsg) != MPI_SUCCESS) {
+    if (create_init_msg(commtab->rank, self->address, self->port, &pMsg)
+	!= MSG_SUCCESS) {
 	dprintf("Failed to create init message\n");
 	return MPI_ERR_OTHER;
     }
+    pMsg->init.flags = flags;
     dprintf("Sending message\n");
     print_msg_hdr(pMsg);
 
     //send init message
-    if (send_msg(sockfd, pMsg) != MPI_SUCCESS) {
+    if (send_msg(fd, pMsg) != MSG_SUCCESS) {
 	dprintf("Failed to send message\n");
+	free_init_msg(pMsg);
 	return MPI_ERR_OTHER;
     }
-    //copy the socket descriptor
-    commtab->ctable[ROOT].fd = sockfd;
-    commtab->ctable[ROOT].address = 0;
-    commtab->ctable[ROOT].port = root_port;
 
-    //free init message
-    free(pMsg);
+    free_init_msg(pMsg);
     return MPI_SUCCESS;
 }
 
 /**
- * This function initializes MPI library.
+ * This function accepts a connection on listening socket and reads the
+ * MSG_INIT message identifying the peer.
  *
+ * Output parameters
+ * 		fd 		connected socket descriptor
+ * 		pMsg 		init message of the peer
+ * Return value
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER 
  */
-int MPI_Init(int *pargc, char ***pargv)
+int __accept_peer(int listen_fd, int *fd, msg_t ** pMsg)
 {
+    int newsockfd = accept(listen_fd, (struct sockaddr *) NULL, 0);
+    int nodelay = 1;
 
-    if (!pargc || !pargv) {
-	return MPI_ERR_OTHER;
-    }
-
-    char *hostname;		//hostname of the processor
-    char *root_hostname;	//hostname of the root
-    int root_port;		//root port
-    int rank;			//rank of this processor
-    int nr_processors;		//nr_processors count
-
-
-    //check if library is already initialized
-    if (is_initialized) {
+    if (newsockfd < 0) {
+	dprintf("failed to accept connection\n");
 	return MPI_ERR_OTHER;
     }
-    //parse arguments
-    if (__parse_arguments
-	(pargc, pargv, &hostname, &root_hostname, &root_port, &rank,
-	 &nr_processors) != MPI_SUCCESS) {
+    setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+	       sizeof(nodelay));
+    //get the rank of the process
+    if (read_msg(newsockfd, pMsg) != MSG_SUCCESS) {
+	dprintf("Failed to read message for new connection\n");
+	close(newsockfd);
 	return MPI_ERR_OTHER;
     }
-    //initialize global communicator object
-    if (__initialize_comm(nr_processors, rank) != MPI_SUCCESS) {
+    print_msg_hdr(*pMsg);
+    if (!((*pMsg)->type & MSG_INIT)
+	|| (*pMsg)->init.rank >= commtab->size) {
+	dprintf("Expecting MSG_INIT message\n");
+	free_init_msg(*pMsg);
+	close(newsockfd);
 	return MPI_ERR_OTHER;
     }
-    //populate connection descriptors
-    if (rank == ROOT) {
-	if (__populate_root_comm(root_port, nr_processors) != MPI_SUCCESS) {
-	    dprintf("Failed to populate communicator object for root\n");
-	    return MPI_ERR_OTHER;
-	}
-    } else {
-	if (__populate_non_root_comm(rank, root_hostname, root_port) !=
-	    MPI_SUCCESS) {
-	    dprintf
-		("Failed to populate communicator object for non root processors");
-	}
-    }
-
-    //set MPI library is intialized
-    is_initialized = TRUE;
 
+    *fd = newsockfd;
     return MPI_SUCCESS;
 }
 
 /**
- * This function returns size of the communicator.
+ * This function takes the complete MSG_INIT message of a registering
+ * processor. The registration is acknowledged at once with MSG_INIT of
+ * root, which accepts the shared memory channel offered if any; the
+ * address table follows once every processor is registered.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER
  */
-int MPI_Comm_size(MPI_Comm handle, int *size)
+int __register_peer(struct registration *reg)
 {
-    if (!is_initialized) {
+    struct context_table *ctable = commtab->ctable;
+    int rank = reg->hdr.init.rank;
+
+    print_msg_hdr(&reg->hdr);
+    if (!(reg->hdr.type & MSG_INIT) || reg->hdr.length != 0
+	|| rank >= commtab->size) {
+	dprintf("Expecting MSG_INIT message\n");
 	return MPI_ERR_OTHER;
     }
-    if (!size) {
+    if (rank == ROOT || ctable[rank].fd) {
+	dprintf("Duplicate registration of rank:%d\n", rank);
 	return MPI_ERR_OTHER;
     }
-    //Ignoring handle parameter and return MPI_COMM_WORLD size 
-    *size = commtab->size;
+    ctable[rank].address = reg->hdr.init.address;
+    ctable[rank].port = reg->hdr.init.port;
+    if ((reg->hdr.init.flags & INIT_FLAG_SHM) && __same_host(rank)
+	&& shm_channel_attach(ctable[ROOT].port, rank,
+			      &ctable[rank].shm) != MSG_SUCCESS) {
+	ctable[rank].shm = NULL;
+    }
+    if (__send_init(reg->fd, ctable[rank].shm ? INIT_FLAG_SHM : 0) !=
+	MPI_SUCCESS) {
+	shm_channel_destroy(ctable[rank].shm);
+	ctable[rank].shm = NULL;
+	return MPI_ERR_OTHER;
+    }
+    ctable[rank].fd = reg->fd;
     return MPI_SUCCESS;
 }
 
 /**
- * This method retrieves rank of the current processor in 
- * the communicator.
+ * This function accepts registrations of all the other processors. Every
+ * accepted connection gets a slot and its MSG_INIT message is read as it
+ * arrives, so a slow processor holds up neither accepting nor reading the
+ * others.
  *
- * Input parameters
- * 	handle	   handle to communicator object
- * Output parameters
- * 	rank 	   rank of the processor
  * Return value
- *      MPI_SUCCESS if processor is part of communicator
- *      else MPI_ERROR 	
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER
  */
-int MPI_Comm_rank(MPI_Comm handle, int *rank)
+int __accept_registrations(int nr_processors)
 {
-    if (!is_initialized) {
+    struct epoll_event events[BOOTSTRAP_EVENTS];
+    struct epoll_event event;
+    struct registration *regs;
+    struct registration *reg;
+    int conn_count = 0;
+    int ret = MPI_SUCCESS;
+    int nodelay = 1;
+    int nready;
+    int epfd;
+    int fd;
+    int i;
+    int n;
+
+    regs = (struct registration *)
+	malloc(sizeof(struct registration) * nr_processors);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!regs || epfd < 0) {
+	dprintf("Failed to set up registration\n");
+	free(regs);
+	if (epfd >= 0) {
+	    close(epfd);
+	}
 	return MPI_ERR_OTHER;
     }
+    memset(regs, 0, sizeof(struct registration) * nr_processors);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, commtab->listen_fd, &event) < 0) {
+	dprintf("Failed to watch listening server\n");
+	ret = MPI_ERR_OTHER;
+    }
 
-    if (!rank) {
-	return MPI_ERR_OTHER;
+    while (ret == MPI_SUCCESS && conn_count < nr_processors - 1) {
+	nready = epoll_wait(epfd, events, BOOTSTRAP_EVENTS, -1);
+	if (nready < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    dprintf("Failed to wait for registrations\n");
+	    ret = MPI_ERR_OTHER;
+	    break;
+	}
+	for (i = 0; i < nready; i++) {
+	    reg = (struct registration *) events[i].data.ptr;
+	    if (!reg) {
+		fd = accept(commtab->listen_fd, (struct sockaddr *) NULL, 0);
+		if (fd < 0) {
+		    dprintf("failed to accept connection\n");
+		    continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+			   sizeof(nodelay));
+		//no more connections than processors may be pending
+		for (n = 0; n < nr_processors && regs[n].fd; n++);
+		event.data.ptr = &regs[n];
+		if (n == nr_processors
+		    || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		    dprintf("Dropping connection fd:%d\n", fd);
+		    close(fd);
+		    continue;
+		}
+		regs[n].fd = fd;
+		regs[n].got = 0;
+		continue;
+	    }
+	    n = recv(reg->fd, (char *) &reg->hdr + reg->got,
+		     MIN_MSG_LENGTH - reg->got, MSG_DONTWAIT);
+	    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		continue;
+	    }
+	    if (n > 0) {
+		reg->got += n;
+		if (reg->got < MIN_MSG_LENGTH) {
+		    continue;
+		}
+	    }
+	    //message is complete or connection failed, slot is done
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, reg->fd, NULL);
+	    if (n > 0 && __register_peer(reg) == MPI_SUCCESS) {
+		conn_count++;
+	    } else {
+		dprintf("Dropping registration fd:%d\n", reg->fd);
+		close(reg->fd);
+	    }
+	    reg->fd = 0;
+	}
     }
-    //Ignoring handle parameters and return MPI_COMM_WORLD size 
-    *rank = commtab->rank;
-    return MPI_SUCCESS;
-}
 
+    //connections which never completed a registration
+    for (n = 0; n < nr_processors; n++) {
+	if (regs[n].fd) {
+	    close(regs[n].fd);
+	}
+    }
+    free(regs);
+    close(epfd);
+    return ret;
+}
 
-int MPI_Send(void *buff, int count, MPI_Datatype datatype,
-	     int rank, int tag, MPI_Comm comm)
+/**
+ * This function populates global communicator object for root.
+ * Root accepts registration of every other processor, the address table
+ * is spread from root afterwards by __distribute_table.
+ *
+ * Input parameters
+ * 		root_port 		root server port
+ * 		hostname 		hostname of root
+ * Return value
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER 
+ */
+int __populate_root_comm(int root_port, int nr_processors, char *hostname)
 {
-    if (!is_initialized) {
+    struct context_table *ctable = commtab->ctable;
+    int rank;
+
+    /*start server wait for connections */
+    if (__create_listener(root_port, &commtab->listen_fd,
+			  &ctable[ROOT].port) != MPI_SUCCESS) {
 	return MPI_ERR_OTHER;
     }
-    if (__MPI_Send(commtab->ctable[rank].fd, buff, count, datatype, tag) !=
-	MPI_SUCCESS) {
-	dprintf("failed send message\n");
+    ctable[ROOT].address = ntohl(__getipaddress(hostname));
+
+    //accept connections from all the other nodes
+    if (__accept_registrations(nr_processors) != MPI_SUCCESS) {
 	return MPI_ERR_OTHER;
     }
 
+    //bootstrap is over, hand connections to the progress engine
+    for (rank = 0; rank < nr_processors; rank++) {
+	if (rank != ROOT
+	    && progress_add_connection(rank, ctable[rank].fd) !=
+	    MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    }
+
     return MPI_SUCCESS;
 }
 
 /**
- * This function determines ready descriptor.
- * Output parameters
- * 	    status 	    MPI_Status object updated with source
- * 	    ready_fd    ready file descriptor to read from
+ * This function accepts a pending connection from a peer on the listening
+ * server. Simultaneous connection attempts between two processors are
+ * resolved by rank order: the connection initiated by the lower rank is
+ * kept and the other one is rejected by closing it. Accepted connections
+ * are acknowledged with a MSG_INIT message of this processor.
+ *
  * Return value
- * 	    MPI_SUCCESS on success or else MPI_ERROR_OTHER 
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
  */
-int __get_receive_ready_descriptor(MPI_Status * status, int *ready_fd)
+int __handle_new_connection(void)
 {
+    struct context_table *ctable = commtab->ctable;
+    int fd;
+    int peer;
+    int flags;
+    uint32_t address;
+    uint16_t port;
+    msg_t *pMsg;
 
-    //check arguments
-    if (!status || !ready_fd) {
-	dprintf("Invalid arguments to %s\n", __func__);
+    if (__accept_peer(commtab->listen_fd, &fd, &pMsg) != MPI_SUCCESS) {
 	return MPI_ERR_OTHER;
     }
-
-    /*multiplex io on all descriptors */
-    fd_set rset;
-
-    /*initialize the set: all bits off */
-    FD_ZERO(&rset);
-
-    //loop and add all valid descriptors in communicator
-    int i = 0;
-    int maxfpd = 0;
-    for (i = 0; i < commtab->size; i++) {
-	if (commtab->ctable[i].fd) {
-	    FD_SET(commtab->ctable[i].fd, &rset);
-	    if (maxfpd < commtab->ctable[i].fd) {
-		maxfpd = commtab->ctable[i].fd;
-	    }
+    peer = pMsg->init.rank;
+    flags = pMsg->init.flags;
+    address = pMsg->init.address;
+    port = pMsg->init.port;
+    free_init_msg(pMsg);
+
+    //extra stream of a connection needs no acknowledgement
+    if (flags & INIT_FLAG_STRIPE) {
+	if (peer == commtab->rank || !ctable[peer].fd
+	    || progress_add_stripe(peer, flags >> INIT_STRIPE_SHIFT, fd) !=
+	    MPI_SUCCESS) {
+	    dprintf("Unexpected stream from rank:%d\n", peer);
+	    close(fd);
+	    return MPI_ERR_OTHER;
 	}
+	return MPI_SUCCESS;
     }
-
-    //wait for any of the ready objects to be ready
-    if (select(maxfpd + 1, &rset, NULL, NULL, NULL) < 0) {
-	dprintf("Failed to receive message from any of the source\n");
+    //our own attempt to the same peer wins if we are the lower rank
+    if (peer == commtab->connecting && commtab->rank < peer) {
+	dprintf("Rejecting crossing connection from rank:%d\n", peer);
+	close(fd);
+	return MPI_SUCCESS;
+    }
+    if (peer == commtab->rank || ctable[peer].fd) {
+	dprintf("Unexpected connection from rank:%d\n", peer);
+	close(fd);
 	return MPI_ERR_OTHER;
     }
-    //initialize ready descriptor
-    *ready_fd = -1;
-
-    //find the ready descriptor and update processor associated with it in 
-    //status
-    for (i = 0; i < commtab->size; i++) {
-	if (commtab->ctable[i].fd) {
-	    if (FD_ISSET(commtab->ctable[i].fd, &rset)) {
-		*ready_fd = commtab->ctable[i].fd;
-		status->MPI_SOURCE = i;
-		dprintf
-		    ("descriptor ready on connection rank:%d and fd:%d\n",
-		     i, *ready_fd);
-	    }
-	}
+    //parent in the address table tree connects before the table arrives
+    if (!ctable[peer].port) {
+	ctable[peer].address = address;
+	ctable[peer].port = port;
     }
-
-    dprintf("Waiting to receive message from src rank:%d dst rank:%d\n",
-	    status->MPI_SOURCE, g_rank);
-
-    //check the validity of the descriptor
-    if (*ready_fd == -1) {
-	dprintf("Failed to receive message from spurious source\n");
+    //take shared memory channel offered by the peer
+    if ((flags & INIT_FLAG_SHM) && __same_host(peer)
+	&& shm_channel_attach(ctable[commtab->rank].port, peer,
+			      &ctable[peer].shm) != MSG_SUCCESS) {
+	ctable[peer].shm = NULL;
+    }
+    //acknowledge the connection
+    if (__send_init(fd, ctable[peer].shm ? INIT_FLAG_SHM : 0) !=
+	MPI_SUCCESS || progress_add_connection(peer, fd) != MPI_SUCCESS) {
+	shm_channel_destroy(ctable[peer].shm);
+	ctable[peer].shm = NULL;
+	close(fd);
 	return MPI_ERR_OTHER;
     }
+    dprintf("Accepted connection from rank:%d fd:%d\n", peer, fd);
 
     return MPI_SUCCESS;
 }
 
-
-int MPI_Recv(void *buff, int count, MPI_Datatype datatype,
-	     int rank, int tag, MPI_Comm comm, MPI_Status * status)
+/**
+ * This function opens connection to a peer on first use. The connection
+ * request is sent and incoming connections are serviced till the peer
+ * acknowledges it or a crossing connection from the peer wins.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __connect_peer(int peer)
 {
-    if (!is_initialized) {
-	return MPI_ERR_OTHER;
-    }
-    //initialize status object
-    memset(status, 0, sizeof(MPI_Status));
-    msg_t *pMsg;
+    struct context_table *ctable = commtab->ctable;
+    struct shm_channel *shm = NULL;
+    int fd;
+    msg_t hdr;
+    struct pollfd pfd[2];
 
-    //identify ready descriptor
-    int ready_fd;
-    if (__get_receive_ready_descriptor(status, &ready_fd) != MPI_SUCCESS) {
-	dprintf("Failed to identify sending processor node\n");
+    if (__connect_to(ctable[peer].address, ctable[peer].port, &fd) !=
+	MPI_SUCCESS) {
+	dprintf("Failed to connect to rank:%d\n", peer);
 	return MPI_ERR_OTHER;
     }
-    //receive the message
-    if (__MPI_Recv(ready_fd, tag, status, &pMsg) != MPI_SUCCESS) {
-	dprintf("Failed to send message to root\n");
+    //offer shared memory channel to peer on the same host
+    if (__same_host(peer)
+	&& shm_channel_create(ctable[peer].port, commtab->rank, &shm) !=
+	MSG_SUCCESS) {
+	shm = NULL;
+    }
+    if (__send_init(fd, shm ? INIT_FLAG_SHM : 0) != MPI_SUCCESS) {
+	if (shm) {
+	    shm_channel_unlink(ctable[peer].port, commtab->rank);
+	    shm_channel_destroy(shm);
+	}
+	close(fd);
+	return MPI_ERR_OTHER;
+    }
+    commtab->connecting = peer;
+
+    //wait for acknowledgement or crossing connection from peer, only
+    //the two descriptors involved are watched
+    while (!ctable[peer].fd) {
+	pfd[0].fd = commtab->listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fd ? fd : -1;
+	pfd[1].events = POLLIN;
+	if (poll(pfd, 2, -1) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	if (pfd[0].revents & POLLIN) {
+	    __handle_new_connection();
+	}
+	if (fd && pfd[1].revents) {
+	    if (read_msg_hdr(fd, &hdr) == MSG_SUCCESS
+		&& (hdr.type & MSG_INIT) && hdr.init.rank == peer) {
+		if (hdr.init.flags & INIT_FLAG_SHM) {
+		    ctable[peer].shm = shm;
+		    shm = NULL;
+		}
+		if (progress_add_connection(peer, fd) != MPI_SUCCESS) {
+		    shm_channel_destroy(ctable[peer].shm);
+		    ctable[peer].shm = NULL;
+		    close(fd);
+		}
+		fd = 0;
+	    } else {
+		//rejected, peer connection is on its way
+		close(fd);
+		fd = 0;
+	    }
+	}
+    }
+    commtab->connecting = -1;
+
+    //crossing connection from lower ranked peer won
+    if (fd) {
+	close(fd);
+    }
+    //peer has mapped the segment or never will
+    if (__same_host(peer)) {
+	shm_channel_unlink(ctable[peer].port, commtab->rank);
+    }
+    shm_channel_destroy(shm);
+
+    return ctable[peer].fd ? MPI_SUCCESS : MPI_ERR_OTHER;
+}
+
+/**
+ * This function opens an extra stream to a connected peer, which carries
+ * chunks of striped large messages. The MSG_INIT message tells the peer
+ * the number of the stream and nothing is waited for, the peer accepts it
+ * while it waits for the chunks.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __connect_stripe(int peer, int stripe, int *fd)
+{
+    struct context_table *ctable = commtab->ctable;
+
+    //processors connected by mpirun have no server
+    if (!ctable[peer].port) {
+	return MPI_ERR_OTHER;
+    }
+    if (__connect_to(ctable[peer].address, ctable[peer].port, fd) !=
+	MPI_SUCCESS) {
+	dprintf("Failed to open stream to rank:%d\n", peer);
+	return MPI_ERR_OTHER;
+    }
+    if (__send_init(*fd, INIT_FLAG_STRIPE | (stripe << INIT_STRIPE_SHIFT))
+	!= MPI_SUCCESS) {
+	close(*fd);
+	return MPI_ERR_OTHER;
+    }
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function returns descriptor of connection to a peer, connecting
+ * to it first if needed.
+ */
+int __get_connection(int peer, int *fd)
+{
+    //messages to itself never leave the processor
+    if (peer == commtab->rank) {
+	*fd = 0;
+	return MPI_SUCCESS;
+    }
+    if (!commtab->ctable[peer].fd) {
+	if (__connect_peer(peer) != MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    }
+    *fd = commtab->ctable[peer].fd;
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function connects to root, retrying with growing delays while root
+ * is not listening yet.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success else MPI_ERR_OTHER
+ */
+int __connect_root(int *fd)
+{
+    struct context_table *ctable = commtab->ctable;
+    char *timeout = getenv(CONNECT_TIMEOUT_ENV);
+    unsigned long left = DEFAULT_CONNECT_TIMEOUT * 1000000UL;
+    unsigned long delay = CONNECT_RETRY_MIN_US;
+
+    if (timeout && *timeout) {
+	left = strtoul(timeout, NULL, 10) * 1000000UL;
+    }
+    while (__connect_to(ctable[ROOT].address, ctable[ROOT].port, fd) !=
+	   MPI_SUCCESS) {
+	if (left < delay) {
+	    return MPI_ERR_OTHER;
+	}
+	usleep(delay);
+	left -= delay;
+	delay = delay * 2 < CONNECT_RETRY_MAX_US ? delay * 2 :
+	    CONNECT_RETRY_MAX_US;
+    }
+    return MPI_SUCCESS;
+}
+
+/** 
+ * This function initializes communicator object for non root.
+ * The processor opens its own server and registers it with root. The
+ * address table of all processors follows from __distribute_table, and
+ * connections to other non root processors are opened on first use.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __populate_non_root_comm(int rank, char *hostname, char *root_hostname,
+			     int root_port)
+{
+    struct context_table *ctable = commtab->ctable;
+
+    //start own server for peer connections
+    if (__create_listener(0, &commtab->listen_fd, &ctable[rank].port) !=
+	MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    ctable[rank].address = ntohl(__getipaddress(hostname));
+
+    /*connect */
+    int sockfd;
+    struct hostent *server;
+    msg_t *pMsg;
+
+    server = gethostbyname(root_hostname);
+    if (server == NULL) {
+	dprintf("No such host\n");
+	return MPI_ERR_OTHER;
+    }
+
+    ctable[ROOT].address = ntohl(*(uint32_t *) server->h_addr);
+    ctable[ROOT].port = root_port;
+    if (__connect_root(&sockfd) != MPI_SUCCESS) {
+	dprintf("Failed to connect to server rank:%d\n", rank);
+	return MPI_ERR_OTHER;
+    }
+    //register with root, offering shared memory channel on the same host
+    struct shm_channel *shm = NULL;
+    int ret;
+    if (__same_host(ROOT)
+	&& shm_channel_create(root_port, rank, &shm) != MSG_SUCCESS) {
+	shm = NULL;
+    }
+    ret = __send_init(sockfd, shm ? INIT_FLAG_SHM : 0);
+
+    //root acknowledges registration, answering the offer
+    if (ret == MPI_SUCCESS && read_msg(sockfd, &pMsg) != MSG_SUCCESS) {
+	dprintf("Failed to receive acknowledgement\n");
+	ret = MPI_ERR_OTHER;
+    }
+    //root has mapped the segment or never will
+    if (shm) {
+	shm_channel_unlink(root_port, rank);
+    }
+    if (ret != MPI_SUCCESS) {
+	shm_channel_destroy(shm);
+	close(sockfd);
+	return MPI_ERR_OTHER;
+    }
+    print_msg_hdr(pMsg);
+    if (!(pMsg->type & MSG_INIT)) {
+	dprintf("Expecting MSG_INIT message\n");
+	free_init_msg(pMsg);
+	shm_channel_destroy(shm);
+	close(sockfd);
+	return MPI_ERR_OTHER;
+    }
+    if (pMsg->init.flags & INIT_FLAG_SHM) {
+	ctable[ROOT].shm = shm;
+    } else {
+	shm_channel_destroy(shm);
+    }
+    free_init_msg(pMsg);
+
+    //bootstrap is over, hand connection to the progress engine
+    if (progress_add_connection(ROOT, sockfd) != MPI_SUCCESS) {
+	shm_channel_destroy(ctable[ROOT].shm);
+	ctable[ROOT].shm = NULL;
+	close(sockfd);
+	return MPI_ERR_OTHER;
+    }
+
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function waits for bootstrap requests and releases them.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else the error of a request
+ */
+int __wait_bootstrap(MPI_Request * requests, int count)
+{
+    int ret = MPI_SUCCESS;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	while (!requests[i]->complete) {
+	    if (progress_poll(-1) != MPI_SUCCESS) {
+		return MPI_ERR_OTHER;
+	    }
+	}
+    }
+    for (i = 0; i < count; i++) {
+	if (ret == MPI_SUCCESS) {
+	    ret = requests[i]->error;
+	}
+	progress_free_request(requests[i]);
+    }
+    return ret;
+}
+
+/**
+ * This function spreads the address table of all processors from root
+ * down a binomial tree. Every non root processor receives it from the rank
+ * with its lowest set bit cleared, which connects on first use as usual,
+ * and forwards it to the ranks differing in a lower bit. Root sends
+ * ceil(log2(size)) copies instead of one per processor.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __distribute_table(void)
+{
+    struct context_table *ctable = commtab->ctable;
+    unsigned int length = sizeof(struct init_hdr) * commtab->size;
+    int rank = commtab->rank;
+    MPI_Request requests[sizeof(int) * 8];
+    struct init_hdr *entries;
+    int nr_requests = 0;
+    int mask = 1;
+    int ret = MPI_SUCCESS;
+    int i;
+
+    entries = (struct init_hdr *) malloc(length);
+    if (!entries) {
+	dprintf("Failed to allocate address table\n");
 	return MPI_ERR_OTHER;
     }
-    //copy data to buffer
-    memcpy(buff, pMsg->payload, pMsg->length);
+    memset(entries, 0, length);
+
+    if (rank == ROOT) {
+	for (i = 0; i < commtab->size; i++) {
+	    entries[i].rank = i;
+	    entries[i].address = ctable[i].address;
+	    entries[i].port = ctable[i].port;
+	}
+	while (mask < commtab->size) {
+	    mask <<= 1;
+	}
+    } else {
+	while (!(rank & mask)) {
+	    mask <<= 1;
+	}
+	if (__coll_irecv(entries, length, rank - mask, COLL_TAG_TABLE,
+			 &requests[0]) != MPI_SUCCESS
+	    || __wait_bootstrap(requests, 1) != MPI_SUCCESS) {
+	    dprintf("Failed to receive address table\n");
+	    free(entries);
+	    return MPI_ERR_OTHER;
+	}
+	for (i = 0; i < commtab->size; i++) {
+	    ctable[i].address = entries[i].address;
+	    ctable[i].port = entries[i].port;
+	}
+    }
+
+    //largest subtree first
+    for (mask >>= 1; mask > 0 && ret == MPI_SUCCESS; mask >>= 1) {
+	if (rank + mask < commtab->size) {
+	    ret = __coll_isend(entries, length, rank + mask, COLL_TAG_TABLE,
+			       &requests[nr_requests]);
+	    if (ret == MPI_SUCCESS) {
+		nr_requests++;
+	    }
+	}
+    }
+    if (nr_requests > 0 && __wait_bootstrap(requests, nr_requests) !=
+	MPI_SUCCESS) {
+	ret = MPI_ERR_OTHER;
+    }
+    if (ret != MPI_SUCCESS) {
+	dprintf("Failed to forward address table\n");
+    }
+    free(entries);
+    return ret;
+}
 
-    free(pMsg);
+/**
+ * This function initializes communicator object of a processor started by
+ * mpirun, which connected every pair of processors before starting them.
+ * Nothing listens and nothing is exchanged, the descriptors go straight to
+ * the progress engine. All processors share the host, so they share an
+ * address too, and having no server they open no extra streams.
+ *
+ * Return value
+ * 		MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __populate_launched_comm(char *fds)
+{
+    char *next = fds;
+    int fd;
+    int i;
+
+    for (i = 0; i < commtab->size; i++) {
+	fd = (int) strtol(next, &next, 10);
+	if (i != commtab->rank
+	    && (fd <= 0 || progress_add_connection(i, fd) != MPI_SUCCESS)) {
+	    dprintf("No connection to rank:%d in %s\n", i, MYMPI_FDS_ENV);
+	    return MPI_ERR_OTHER;
+	}
+	if (*next == ',') {
+	    next++;
+	}
+    }
     return MPI_SUCCESS;
 }
 
+/**
+ * This function initializes MPI library.
+ *
+ */
+int MPI_Init(int *pargc, char ***pargv)
+{
+
+    if (!pargc || !pargv) {
+	return MPI_ERR_OTHER;
+    }
+
+    char *hostname;		//hostname of the processor
+    char *root_hostname;	//hostname of the root
+    int root_port;		//root port
+    int rank;			//rank of this processor
+    int nr_processors;		//nr_processors count
+    char *fds = getenv(MYMPI_FDS_ENV);	//connections set up by mpirun
+
+
+    //check if library is already initialized
+    if (is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    //parse arguments
+    if (fds) {
+	if (__parse_environment(&rank, &nr_processors) != MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    } else if (__parse_arguments
+	       (pargc, pargv, &hostname, &root_hostname, &root_port, &rank,
+		&nr_processors) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    //pick reduction kernels for this processor
+    op_init();
+
+    //initialize global communicator object
+    if (__initialize_comm(nr_processors, rank) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    //populate connection descriptors
+    if (fds) {
+	if (__populate_launched_comm(fds) != MPI_SUCCESS) {
+	    dprintf("Failed to take connections from mpirun\n");
+	    return MPI_ERR_OTHER;
+	}
+    } else if (rank == ROOT) {
+	if (__populate_root_comm(root_port, nr_processors, hostname) !=
+	    MPI_SUCCESS) {
+	    dprintf("Failed to populate communicator object for root\n");
+	    return MPI_ERR_OTHER;
+	}
+    } else {
+	if (__populate_non_root_comm
+	    (rank, hostname, root_hostname, root_port) != MPI_SUCCESS) {
+	    dprintf
+		("Failed to populate communicator object for non root processors");
+	    return MPI_ERR_OTHER;
+	}
+    }
+    //peers connect lazily through the listening server
+    if (commtab->listen_fd
+	&& progress_watch_listener(commtab->listen_fd) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    //spread addresses of all processors
+    if (commtab->listen_fd && __distribute_table() != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    //group processors by node for collectives
+    if (coll_init() != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+
+    //set MPI library is intialized
+    is_initialized = TRUE;
+
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function returns size of the communicator.
+ */
+int MPI_Comm_size(MPI_Comm handle, int *size)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (!size) {
+	return MPI_ERR_OTHER;
+    }
+    //Ignoring handle parameter and return MPI_COMM_WORLD size 
+    *size = commtab->size;
+    return MPI_SUCCESS;
+}
+
+/**
+ * This method retrieves rank of the current processor in 
+ * the communicator.
+ *
+ * Input parameters
+ * 	handle	   handle to communicator object
+ * Output parameters
+ * 	rank 	   rank of the processor
+ * Return value
+ *      MPI_SUCCESS if processor is part of communicator
+ *      else MPI_ERROR 	
+ */
+int MPI_Comm_rank(MPI_Comm handle, int *rank)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+
+    if (!rank) {
+	return MPI_ERR_OTHER;
+    }
+    //Ignoring handle parameters and return MPI_COMM_WORLD size 
+    *rank = commtab->rank;
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * This function validates arguments of a point to point operation.
+ */
+static int __check_p2p_args(int count, MPI_Datatype datatype, int rank,
+			    int tag, int is_recv)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (count < 0) {
+	return MPI_ERR_COUNT;
+    }
+    if (datatype < MPI_CHAR || datatype > MPI_DOUBLE) {
+	return MPI_ERR_TYPE;
+    }
+    if (!(is_recv && rank == MPI_ANY_SOURCE)
+	&& (rank < 0 || rank >= commtab->size)) {
+	return MPI_ERR_RANK;
+    }
+    if (!(is_recv && tag == MPI_ANY_TAG) && (tag < 0 || tag > MPI_TAG_UB)) {
+	return MPI_ERR_TAG;
+    }
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function validates arguments common to collective operations.
+ */
+int __check_coll_args(int count, MPI_Datatype datatype, int root)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (count < 0) {
+	return MPI_ERR_COUNT;
+    }
+    if (datatype < MPI_CHAR || datatype > MPI_DOUBLE) {
+	return MPI_ERR_TYPE;
+    }
+    if (root < 0 || root >= commtab->size) {
+	return MPI_ERR_ROOT;
+    }
+    return MPI_SUCCESS;
+}
+
+/**
+ * This function starts sending length bytes of a collective operation to
+ * a peer, connecting to it first if needed.
+ */
+int __coll_isend(void *buff, unsigned int length, int peer, int tag,
+		 MPI_Request * request)
+{
+    int fd;
+
+    if (__get_connection(peer, &fd) != MPI_SUCCESS) {
+	dprintf("failed to connect to rank:%d\n", peer);
+	return MPI_ERR_OTHER;
+    }
+    return progress_isend(buff, length, MPI_CHAR, peer, tag, request);
+}
+
+/**
+ * This function starts receiving at most length bytes of a collective
+ * operation from a peer.
+ */
+int __coll_irecv(void *buff, unsigned int length, int peer, int tag,
+		 MPI_Request * request)
+{
+    return progress_irecv(buff, length, peer, tag, request);
+}
+
+int MPI_Isend(void *buff, int count, MPI_Datatype datatype, int rank,
+	      int tag, MPI_Comm comm, MPI_Request * request)
+{
+    int ret = __check_p2p_args(count, datatype, rank, tag, FALSE);
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    //open connection on first use
+    int fd;
+    if (__get_connection(rank, &fd) != MPI_SUCCESS) {
+	dprintf("failed to connect to rank:%d\n", rank);
+	return MPI_ERR_OTHER;
+    }
+    return progress_isend(buff, datatype_mappings[datatype].size * count,
+			  datatype, rank, tag, request);
+}
+
+int MPI_Irecv(void *buff, int count, MPI_Datatype datatype, int rank,
+	      int tag, MPI_Comm comm, MPI_Request * request)
+{
+    int ret = __check_p2p_args(count, datatype, rank, tag, TRUE);
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    return progress_irecv(buff, datatype_mappings[datatype].size * count,
+			  rank, tag, request);
+}
+
+int MPI_Send(void *buff, int count, MPI_Datatype datatype,
+	     int rank, int tag, MPI_Comm comm)
+{
+    MPI_Request request;
+    int ret = MPI_Isend(buff, count, datatype, rank, tag, comm, &request);
+    if (ret != MPI_SUCCESS) {
+	dprintf("failed send message\n");
+	return ret;
+    }
+    return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+int MPI_Recv(void *buff, int count, MPI_Datatype datatype,
+	     int rank, int tag, MPI_Comm comm, MPI_Status * status)
+{
+    MPI_Request request;
+    int ret = MPI_Irecv(buff, count, datatype, rank, tag, comm, &request);
+    if (ret != MPI_SUCCESS) {
+	return ret;
+    }
+    return MPI_Wait(&request, status);
+}
+
+/**
+ * This function reports completed request in status, releases it and
+ * resets the handle to MPI_REQUEST_NULL.
+ */
+static int __complete_request(MPI_Request * request, MPI_Status * status)
+{
+    MPI_Request req = *request;
+    int ret = req->error;
+
+    if (status) {
+	*status = req->status;
+    }
+    progress_free_request(req);
+    *request = MPI_REQUEST_NULL;
+    return ret;
+}
+
+/**
+ * This function reports empty status for inactive request.
+ */
+static inline void __empty_status(MPI_Status * status)
+{
+    if (status) {
+	status->MPI_SOURCE = MPI_ANY_SOURCE;
+	status->MPI_TAG = MPI_ANY_TAG;
+	status->length = 0;
+    }
+}
+
+int MPI_Wait(MPI_Request * request, MPI_Status * status)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (!request) {
+	return MPI_ERR_REQUEST;
+    }
+    if (*request == MPI_REQUEST_NULL) {
+	__empty_status(status);
+	return MPI_SUCCESS;
+    }
+    //drive the progress engine till request is done
+    while (!(*request)->complete) {
+	if (progress_poll(-1) != MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    }
+    return __complete_request(request, status);
+}
+
+int MPI_Test(MPI_Request * request, int *flag, MPI_Status * status)
+{
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (!request || !flag) {
+	return MPI_ERR_REQUEST;
+    }
+    if (*request == MPI_REQUEST_NULL) {
+	*flag = TRUE;
+	__empty_status(status);
+	return MPI_SUCCESS;
+    }
+    if (!(*request)->complete && progress_poll(0) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    *flag = (*request)->complete;
+    if (!*flag) {
+	return MPI_SUCCESS;
+    }
+    return __complete_request(request, status);
+}
+
+int MPI_Waitall(int count, MPI_Request * requests, MPI_Status * statuses)
+{
+    int i;
+    int ret;
+    int err = MPI_SUCCESS;
+
+    if (count < 0) {
+	return MPI_ERR_COUNT;
+    }
+    if (count > 0 && !requests) {
+	return MPI_ERR_REQUEST;
+    }
+    //every request is waited for even if some of them fail
+    for (i = 0; i < count; i++) {
+	ret = MPI_Wait(&requests[i], statuses ? &statuses[i] : NULL);
+	if (ret != MPI_SUCCESS && err == MPI_SUCCESS) {
+	    err = ret;
+	}
+    }
+    return err;
+}
+
+int MPI_Waitany(int count, MPI_Request * requests, int *index,
+		MPI_Status * status)
+{
+    int i;
+    int active;
+
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (count < 0) {
+	return MPI_ERR_COUNT;
+    }
+    if ((count > 0 && !requests) || !index) {
+	return MPI_ERR_REQUEST;
+    }
+
+    while (TRUE) {
+	active = FALSE;
+	for (i = 0; i < count; i++) {
+	    if (requests[i] == MPI_REQUEST_NULL) {
+		continue;
+	    }
+	    active = TRUE;
+	    if (requests[i]->complete) {
+		*index = i;
+		return __complete_request(&requests[i], status);
+	    }
+	}
+	if (!active) {
+	    //nothing to wait for
+	    *index = MPI_UNDEFINED;
+	    __empty_status(status);
+	    return MPI_SUCCESS;
+	}
+	if (progress_poll(-1) != MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    }
+}
+
+int MPI_Testsome(int incount, MPI_Request * requests, int *outcount,
+		 int *indices, MPI_Status * statuses)
+{
+    int i;
+    int ret;
+    int active = FALSE;
+    int err = MPI_SUCCESS;
+
+    if (!is_initialized) {
+	return MPI_ERR_OTHER;
+    }
+    if (incount < 0) {
+	return MPI_ERR_COUNT;
+    }
+    if ((incount > 0 && !requests) || !outcount || !indices) {
+	return MPI_ERR_REQUEST;
+    }
+    if (progress_poll(0) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+
+    *outcount = 0;
+    for (i = 0; i < incount; i++) {
+	if (requests[i] == MPI_REQUEST_NULL) {
+	    continue;
+	}
+	active = TRUE;
+	if (requests[i]->complete) {
+	    indices[*outcount] = i;
+	    ret = __complete_request(&requests[i],
+				     statuses ? &statuses[*outcount] :
+				     NULL);
+	    if (ret != MPI_SUCCESS && err == MPI_SUCCESS) {
+		err = ret;
+	    }
+	    (*outcount)++;
+	}
+    }
+    if (!active) {
+	*outcount = MPI_UNDEFINED;
+    }
+    return err;
+}
+
 
 int MPI_Get_count(MPI_Status * status, MPI_Datatype datatype, int *count)
 {
@@ -562,32 +1535,56 @@ int MPI_Get_count(MPI_Status * status, MPI_Datatype datatype, int *count)
 	return MPI_ERR_OTHER;
     }
 
-    *count = status->length / datatype_mappings[datatype];
+    *count = status->length / datatype_mappings[datatype].size;
     return MPI_SUCCESS;
 }
 
 
 int MPI_Finalize(void)
 {
+    char *report = getenv(POOL_STATS_ENV);
+    struct msg_pool_stats pool_stats;
+
     if (!is_initialized) {
 	return MPI_ERR_OTHER;
     }
 
-    //non root users block till root says exit
-    if (g_rank != ROOT) {
-	char buf;
-	while (read(commtab->ctable[ROOT].fd, &buf, sizeof(char)) < 0) {
-	    ;
-	}
+    //nobody leaves before everybody is done communicating
+    if (MPI_Barrier(MPI_COMM_WORLD) != MPI_SUCCESS) {
+	dprintf("Failed to synchronize before shutdown\n");
     }
-    //close all connection descriptors
+    //messages completed while coalesced may still be on this side
+    if (progress_flush() != MPI_SUCCESS) {
+	dprintf("Failed to flush messages before shutdown\n");
+    }
+    coll_finalize();
+    //close all connections
     struct context_table *ctable = commtab->ctable;
     int i;
     for (i = 0; i < commtab->size; i++) {
 	if (ctable[i].fd) {
-	    close(ctable[i].fd);
+	    progress_close_connection(i);
 	}
     }
+    if (commtab->listen_fd) {
+	close(commtab->listen_fd);
+    }
+    close(commtab->epfd);
+    progress_finalize();
+    match_engine_destroy(commtab->match);
+
+    //report and release cached message buffers
+    msg_pool_get_stats(&pool_stats);
+    dprintf("message pool hits:%lu misses:%lu releases:%lu drops:%lu\n",
+	    pool_stats.hits, pool_stats.misses, pool_stats.releases,
+	    pool_stats.drops);
+    if (report && *report && strcmp(report, "0") != 0) {
+	fprintf(stderr, "rank %d message pool hits:%lu misses:%lu "
+		"releases:%lu drops:%lu cached:%lu bytes\n", commtab->rank,
+		pool_stats.hits, pool_stats.misses, pool_stats.releases,
+		pool_stats.drops, pool_stats.cached_bytes);
+    }
+    msg_pool_drain();
 
     //free memory
     if (ctable) {
@@ -6,6 +6,7 @@
 #define MY_MPI_H
 
 #include "mympidatatype.h"
+#include "mympiop.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>		//for MPI_Wtime
@@ -28,12 +29,31 @@
 			       //communicator minus one; ranks in a receive 
 			       //(MPI_Recv, MPI_Irecv, MPI_Sendrecv, etc.) 
 			       //may also be MPI_ANY_SOURCE.
+#define MPI_ERR_TRUNCATE -6	//Message truncated on receive. The buffer
+			       //size specified was too small for the
+			       //received message.
+#define MPI_ERR_REQUEST  -7	//Invalid MPI_Request. Either null or, in the
+			       //case of a MPI_Start or MPI_Startall, not a
+			       //persistent request.
+#define MPI_ERR_ROOT     -8	//Invalid root. The root must be specified as
+			       //a rank in the communicator.
+#define MPI_ERR_OP       -9	//Invalid operation. The operation is not
+			       //defined for the datatype.
 
 
 
 /*MPI TAG Constants*/
-#define MPI_ANY_SOURCE 0
-#define MPI_ANY_TAG    1
+#define MPI_ANY_SOURCE -1
+#define MPI_ANY_TAG    -1
+
+/*Largest tag of the application, tags above it are used by collectives*/
+#define MPI_TAG_UB     0x3fffffff
+
+/*Send buffer of a collective which takes its input from receive buffer*/
+#define MPI_IN_PLACE   ((void *) -1)
+
+/*Value returned for undefined index and count*/
+#define MPI_UNDEFINED  -32766
 
 static inline double MPI_Wtime()
 {
@@ -52,32 +72,63 @@ typedef int MPI_Comm;
 /*Status definition*/
 struct _MPI_Status {
     int MPI_SOURCE;		//Source of the message
+    int MPI_TAG;		//Tag of the message
     int length;			//length of message received so far
 };
 
 typedef struct _MPI_Status MPI_Status;
 
+/*Status may be ignored by passing these*/
+#define MPI_STATUS_IGNORE   ((MPI_Status *) 0)
+#define MPI_STATUSES_IGNORE ((MPI_Status *) 0)
+
+/*Handle of non-blocking operation, see myprogress.h*/
+typedef struct _MPI_Request *MPI_Request;
+
+#define MPI_REQUEST_NULL ((MPI_Request) 0)
+
+/*Connection transports, see mytransport.h and myshm.h*/
+struct transport;
+struct shm_channel;
+
 /*Context table definition*/
 struct context_table {
     int fd;			//connection file descriptor
     uint32_t address;		//ip address in host byte order 
     uint16_t port;		//port address in host byte order
+    const struct transport *transport;	//how bytes of the connection travel
+    struct shm_channel *shm;	//shared memory channel or NULL
 };
 
+/*Matching queues, see mymatch.h*/
+struct match_engine;
+
 /*My MPI Comm*/
 struct _MPI_Comm {
     unsigned int size;		//size of the communicator
     unsigned int rank;		//rank of the processor in communicator
     struct context_table *ctable;	//array of entries in context table
     //index is determined by rank
+    int listen_fd;		//listening server of this processor
+    int connecting;		//rank of peer being connected to or -1
+    int epfd;			//epoll instance of the progress engine
+    struct match_engine *match;	//posted and unexpected message queues
 };
 
 
 /*MPI_Comm Constants*/
 #define MPI_COMM_WORLD 0
 
+/*Environment of processors started by mpirun, see mpirun.c. MYMPI_FDS
+ *lists the descriptor connected to every rank, separated by commas*/
+#define MYMPI_SIZE_ENV "MYMPI_SIZE"
+#define MYMPI_RANK_ENV "MYMPI_RANK"
+#define MYMPI_FDS_ENV  "MYMPI_FDS"
+
 /**
- * Initialize the MPI execution environment
+ * Initialize the MPI execution environment. Processors started by mpirun
+ * with connections already in place take rank and size from environment,
+ * any others from the last five arguments.
  * Input parameters
  * 	argc: Pointer to the number of arguments
  * 	argv: Pointer to the argument vector
@@ -120,7 +171,8 @@ int MPI_Comm_rank(MPI_Comm /*handle */ , int * /*rank */ );
 int MPI_Get_processor_name(char *, int *);
 
 /** 
- *  Performs a blocking send
+ *  Performs a blocking send. A processor may send to itself, such a
+ *  message is copied at once and waits for the matching receive.
  *
  *  Input Parameters
  *  buf:   initial address of send buffer (choice)
@@ -154,6 +206,116 @@ int MPI_Recv(void * /*buff */ , int /*count */ ,
 	     int /*rank */ , int /*tag */ , MPI_Comm /*comm */ ,
 	     MPI_Status * /*status */ );
 
+/**
+ * Begins a nonblocking send. A send to the processor itself is complete
+ * on return.
+ *
+ * Input Parameters
+ * buf  initial address of send buffer (choice)
+ * count  number of elements in send buffer (integer)
+ * datatype  datatype of each send buffer element (handle)
+ * dest  rank of destination (integer)
+ * tag  message tag (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * request  communication request (handle)
+ */
+int MPI_Isend(void * /*buff */ , int /*count */ ,
+	      MPI_Datatype /*datatype */ ,
+	      int /*rank */ , int /*tag */ , MPI_Comm /*comm */ ,
+	      MPI_Request * /*request */ );
+
+/**
+ * Begins a nonblocking receive
+ *
+ * Input Parameters
+ * buf  initial address of receive buffer (choice)
+ * count  number of elements in receive buffer (integer)
+ * datatype  datatype of each receive buffer element (handle)
+ * source  rank of source (integer)
+ * tag  message tag (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * request  communication request (handle)
+ */
+int MPI_Irecv(void * /*buff */ , int /*count */ ,
+	      MPI_Datatype /*datatype */ ,
+	      int /*rank */ , int /*tag */ , MPI_Comm /*comm */ ,
+	      MPI_Request * /*request */ );
+
+/**
+ * Waits for an MPI request to complete
+ *
+ * Input Parameters
+ * request  request (handle), set to MPI_REQUEST_NULL on return
+ *
+ * Output Parameters
+ * status  status object (Status). May be MPI_STATUS_IGNORE.
+ */
+int MPI_Wait(MPI_Request * /*request */ , MPI_Status * /*status */ );
+
+/**
+ * Tests for the completion of a request
+ *
+ * Input Parameters
+ * request  MPI request (handle), set to MPI_REQUEST_NULL once complete
+ *
+ * Output Parameters
+ * flag  true if operation completed (logical)
+ * status  status object (Status). May be MPI_STATUS_IGNORE.
+ */
+int MPI_Test(MPI_Request * /*request */ , int * /*flag */ ,
+	     MPI_Status * /*status */ );
+
+/**
+ * Waits for all given MPI Requests to complete
+ *
+ * Input Parameters
+ * count  list length (integer)
+ * array_of_requests  array of request handles (array of handles)
+ *
+ * Output Parameters
+ * array_of_statuses  array of status objects (array of Statuses). May be
+ *                    MPI_STATUSES_IGNORE.
+ */
+int MPI_Waitall(int /*count */ , MPI_Request * /*requests */ ,
+		MPI_Status * /*statuses */ );
+
+/**
+ * Waits for any specified MPI Request to complete
+ *
+ * Input Parameters
+ * count  list length (integer)
+ * array_of_requests  array of requests (array of handles)
+ *
+ * Output Parameters
+ * index  index of handle for operation that completed (integer). Set to
+ *        MPI_UNDEFINED if all requests are MPI_REQUEST_NULL.
+ * status  status object (Status). May be MPI_STATUS_IGNORE.
+ */
+int MPI_Waitany(int /*count */ , MPI_Request * /*requests */ ,
+		int * /*index */ , MPI_Status * /*status */ );
+
+/**
+ * Tests for some given requests to complete
+ *
+ * Input Parameters
+ * incount  length of array_of_requests (integer)
+ * array_of_requests  array of requests (array of handles)
+ *
+ * Output Parameters
+ * outcount  number of completed requests (integer). Set to MPI_UNDEFINED
+ *           if all requests are MPI_REQUEST_NULL.
+ * array_of_indices  array of indices of operations that completed
+ * array_of_statuses  array of status objects for operations that
+ *                    completed. May be MPI_STATUSES_IGNORE.
+ */
+int MPI_Testsome(int /*incount */ , MPI_Request * /*requests */ ,
+		 int * /*outcount */ , int * /*indices */ ,
+		 MPI_Status * /*statuses */ );
+
 /**
  * Gets the number of "top level" elements
  *
@@ -175,6 +337,396 @@ int MPI_Recv(void * /*buff */ , int /*count */ ,
 int MPI_Get_count(MPI_Status * /*status */ , MPI_Datatype /*datatype */ ,
 		  int * /*count */ );
 
+/**
+ * Blocks until all processes in the communicator have reached this routine.
+ *
+ * Input Parameters
+ * comm  communicator (handle)
+ */
+int MPI_Barrier(MPI_Comm /*comm */ );
+
+/**
+ * Notifies the process that it has reached the barrier and returns
+ * immediately
+ *
+ * Input Parameters
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * request  communication request (handle)
+ */
+int MPI_Ibarrier(MPI_Comm /*comm */ , MPI_Request * /*request */ );
+
+/**
+ * Broadcasts a message from the process with rank "root" to all other
+ * processes of the communicator
+ *
+ * Input/Output Parameters
+ * buffer  starting address of buffer (choice)
+ *
+ * Input Parameters
+ * count  number of entries in buffer (integer)
+ * datatype  data type of buffer (handle)
+ * root  rank of broadcast root (integer)
+ * comm  communicator (handle)
+ */
+int MPI_Bcast(void * /*buffer */ , int /*count */ ,
+	      MPI_Datatype /*datatype */ , int /*root */ ,
+	      MPI_Comm /*comm */ );
+
+/**
+ * Broadcasts a message from the process with rank "root" to all other
+ * processes of the communicator in a nonblocking way
+ *
+ * Input/Output Parameters
+ * buffer  starting address of buffer (choice)
+ *
+ * Input Parameters
+ * count  number of entries in buffer (integer)
+ * datatype  data type of buffer (handle)
+ * root  rank of broadcast root (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * request  communication request (handle)
+ */
+int MPI_Ibcast(void * /*buffer */ , int /*count */ ,
+	       MPI_Datatype /*datatype */ , int /*root */ ,
+	       MPI_Comm /*comm */ , MPI_Request * /*request */ );
+
+/**
+ * Reduces values on all processes to a single value
+ *
+ * Input Parameters
+ * sendbuf  address of send buffer (choice), MPI_IN_PLACE at root takes
+ *          input from recvbuf
+ * count  number of elements in send buffer (integer)
+ * datatype  data type of elements of send buffer (handle)
+ * op  reduce operation (handle)
+ * root  rank of root process (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice, significant only at root)
+ */
+int MPI_Reduce(void * /*sendbuf */ , void * /*recvbuf */ , int /*count */ ,
+	       MPI_Datatype /*datatype */ , MPI_Op /*op */ , int /*root */ ,
+	       MPI_Comm /*comm */ );
+
+/**
+ * Combines values from all processes and distributes the result back to
+ * all processes
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * count  number of elements in send buffer (integer)
+ * datatype  data type of elements of send buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice)
+ */
+int MPI_Allreduce(void * /*sendbuf */ , void * /*recvbuf */ ,
+		  int /*count */ , MPI_Datatype /*datatype */ ,
+		  MPI_Op /*op */ , MPI_Comm /*comm */ );
+
+/**
+ * Combines values from all processes and distributes the result back to
+ * all processes in a nonblocking way
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * count  number of elements in send buffer (integer)
+ * datatype  data type of elements of send buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice)
+ * request  communication request (handle)
+ */
+int MPI_Iallreduce(void * /*sendbuf */ , void * /*recvbuf */ ,
+		   int /*count */ , MPI_Datatype /*datatype */ ,
+		   MPI_Op /*op */ , MPI_Comm /*comm */ ,
+		   MPI_Request * /*request */ );
+
+/**
+ * Gathers together values from a group of processes
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE at root
+ *          takes its block from its place in recvbuf
+ * sendcount  number of elements in send buffer (integer)
+ * sendtype  data type of send buffer elements (handle)
+ * recvcount  number of elements for any single receive (integer,
+ *            significant only at root)
+ * recvtype  data type of recv buffer elements (handle, significant only
+ *           at root)
+ * root  rank of receiving process (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice, significant only at root)
+ */
+int MPI_Gather(void * /*sendbuf */ , int /*sendcount */ ,
+	       MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+	       int /*recvcount */ , MPI_Datatype /*recvtype */ ,
+	       int /*root */ , MPI_Comm /*comm */ );
+
+/**
+ * Gathers into specified locations from all processes in a group
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE at root
+ *          takes its block from its place in recvbuf
+ * sendcount  number of elements in send buffer (integer)
+ * sendtype  data type of send buffer elements (handle)
+ * recvcounts  integer array (of length group size) containing the number
+ *             of elements that are received from each process
+ *             (significant only at root)
+ * displs  integer array (of length group size). Entry i specifies the
+ *         displacement relative to recvbuf at which to place the incoming
+ *         data from process i (significant only at root)
+ * recvtype  data type of recv buffer elements (handle, significant only
+ *           at root)
+ * root  rank of receiving process (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice, significant only at root)
+ */
+int MPI_Gatherv(void * /*sendbuf */ , int /*sendcount */ ,
+		MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+		int * /*recvcounts */ , int * /*displs */ ,
+		MPI_Datatype /*recvtype */ , int /*root */ ,
+		MPI_Comm /*comm */ );
+
+/**
+ * Sends data from one process to all other processes in a communicator
+ *
+ * Input Parameters
+ * sendbuf  address of send buffer (choice, significant only at root)
+ * sendcount  number of elements sent to each process (integer,
+ *            significant only at root)
+ * sendtype  data type of send buffer elements (handle, significant only
+ *           at root)
+ * recvcount  number of elements in receive buffer (integer)
+ * recvtype  data type of receive buffer elements (handle)
+ * root  rank of sending process (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice), MPI_IN_PLACE at root
+ *          leaves its block in its place in sendbuf
+ */
+int MPI_Scatter(void * /*sendbuf */ , int /*sendcount */ ,
+		MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+		int /*recvcount */ , MPI_Datatype /*recvtype */ ,
+		int /*root */ , MPI_Comm /*comm */ );
+
+/**
+ * Scatters a buffer in parts to all processes in a communicator
+ *
+ * Input Parameters
+ * sendbuf  address of send buffer (choice, significant only at root)
+ * sendcounts  integer array (of length group size) specifying the number
+ *             of elements to send to each processor
+ * displs  integer array (of length group size). Entry i specifies the
+ *         displacement (relative to sendbuf) from which to take the
+ *         outgoing data to process i
+ * sendtype  data type of send buffer elements (handle)
+ * recvcount  number of elements in receive buffer (integer)
+ * recvtype  data type of receive buffer elements (handle)
+ * root  rank of sending process (integer)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice), MPI_IN_PLACE at root
+ *          leaves its block in its place in sendbuf
+ */
+int MPI_Scatterv(void * /*sendbuf */ , int * /*sendcounts */ ,
+		 int * /*displs */ , MPI_Datatype /*sendtype */ ,
+		 void * /*recvbuf */ , int /*recvcount */ ,
+		 MPI_Datatype /*recvtype */ , int /*root */ ,
+		 MPI_Comm /*comm */ );
+
+/**
+ * Sends data from all to all processes
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          the blocks from recvbuf
+ * sendcount  number of elements to send to each process (integer)
+ * sendtype  data type of send buffer elements (handle)
+ * recvcount  number of elements received from any process (integer)
+ * recvtype  data type of receive buffer elements (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice)
+ */
+int MPI_Alltoall(void * /*sendbuf */ , int /*sendcount */ ,
+		 MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+		 int /*recvcount */ , MPI_Datatype /*recvtype */ ,
+		 MPI_Comm /*comm */ );
+
+/**
+ * Sends data from all to all processes; each process may send a different
+ * amount of data and provide displacements for the input and output data
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          the blocks from recvbuf as laid out by recvcounts and rdispls
+ * sendcounts  integer array equal to the group size specifying the number
+ *             of elements to send to each processor
+ * sdispls  integer array (of length group size). Entry j specifies the
+ *          displacement (relative to sendbuf) from which to take the
+ *          outgoing data destined for process j
+ * sendtype  data type of send buffer elements (handle)
+ * recvcounts  integer array equal to the group size specifying the
+ *             maximum number of elements that can be received from each
+ *             processor
+ * rdispls  integer array (of length group size). Entry i specifies the
+ *          displacement (relative to recvbuf) at which to place the
+ *          incoming data from process i
+ * recvtype  data type of receive buffer elements (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice)
+ */
+int MPI_Alltoallv(void * /*sendbuf */ , int * /*sendcounts */ ,
+		  int * /*sdispls */ , MPI_Datatype /*sendtype */ ,
+		  void * /*recvbuf */ , int * /*recvcounts */ ,
+		  int * /*rdispls */ , MPI_Datatype /*recvtype */ ,
+		  MPI_Comm /*comm */ );
+
+/**
+ * Gathers data from all tasks and distribute the combined data to all
+ * tasks
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          the block from its place in recvbuf
+ * sendcount  number of elements in send buffer (integer)
+ * sendtype  data type of send buffer elements (handle)
+ * recvcount  number of elements received from any process (integer)
+ * recvtype  data type of receive buffer elements (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice)
+ */
+int MPI_Allgather(void * /*sendbuf */ , int /*sendcount */ ,
+		  MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+		  int /*recvcount */ , MPI_Datatype /*recvtype */ ,
+		  MPI_Comm /*comm */ );
+
+/**
+ * Gathers data from all tasks and deliver the combined data to all tasks
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          the block from its place in recvbuf
+ * sendcount  number of elements in send buffer (integer)
+ * sendtype  data type of send buffer elements (handle)
+ * recvcounts  integer array (of length group size) containing the number
+ *             of elements that are to be received from each process
+ * displs  integer array (of length group size). Entry i specifies the
+ *         displacement (relative to recvbuf) at which to place the
+ *         incoming data from process i
+ * recvtype  data type of receive buffer elements (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  address of receive buffer (choice)
+ */
+int MPI_Allgatherv(void * /*sendbuf */ , int /*sendcount */ ,
+		   MPI_Datatype /*sendtype */ , void * /*recvbuf */ ,
+		   int * /*recvcounts */ , int * /*displs */ ,
+		   MPI_Datatype /*recvtype */ , MPI_Comm /*comm */ );
+
+/**
+ * Computes the scan (partial reductions) of data on a collection of
+ * processes
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * count  number of elements in input buffer (integer)
+ * datatype  data type of elements of input buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice)
+ */
+int MPI_Scan(void * /*sendbuf */ , void * /*recvbuf */ , int /*count */ ,
+	     MPI_Datatype /*datatype */ , MPI_Op /*op */ ,
+	     MPI_Comm /*comm */ );
+
+/**
+ * Computes the exclusive scan (partial reductions) of data on a
+ * collection of processes
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * count  number of elements in input buffer (integer)
+ * datatype  data type of elements of input buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice), untouched at
+ *          rank 0
+ */
+int MPI_Exscan(void * /*sendbuf */ , void * /*recvbuf */ , int /*count */ ,
+	       MPI_Datatype /*datatype */ , MPI_Op /*op */ ,
+	       MPI_Comm /*comm */ );
+
+/**
+ * Combines values and scatters the results
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * recvcounts  integer array specifying the number of elements in result
+ *             distributed to each process. Array must be identical on all
+ *             calling processes.
+ * datatype  data type of elements of input buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice)
+ */
+int MPI_Reduce_scatter(void * /*sendbuf */ , void * /*recvbuf */ ,
+		       int * /*recvcounts */ , MPI_Datatype /*datatype */ ,
+		       MPI_Op /*op */ , MPI_Comm /*comm */ );
+
+/**
+ * Combines values and scatters the results in blocks of equal size
+ *
+ * Input Parameters
+ * sendbuf  starting address of send buffer (choice), MPI_IN_PLACE takes
+ *          input from recvbuf
+ * recvcount  element count per block (non-negative integer)
+ * datatype  data type of elements of input buffer (handle)
+ * op  operation (handle)
+ * comm  communicator (handle)
+ *
+ * Output Parameters
+ * recvbuf  starting address of receive buffer (choice)
+ */
+int MPI_Reduce_scatter_block(void * /*sendbuf */ , void * /*recvbuf */ ,
+			     int /*recvcount */ ,
+			     MPI_Datatype /*datatype */ , MPI_Op /*op */ ,
+			     MPI_Comm /*comm */ );
+
 /**
  * Terminates MPI execution environment
  *
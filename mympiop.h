@@ -0,0 +1,18 @@
+/*
+ * This header defines MPI reduction operations.
+ */
+#ifndef __MY_MPI_OP_H
+#define __MY_MPI_OP_H
+
+/*MPI reduction operations*/
+enum _MPI_Op {
+    MPI_SUM,			//sum
+    MPI_MAX,			//maximum
+    MPI_MIN,			//minimum
+    MPI_PROD,			//product
+    MPI_OP_COUNT		//number of operations, not an operation
+};
+
+typedef enum _MPI_Op MPI_Op;
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 #include <errno.h>
@@ -18,6 +19,9 @@
 
 #define MIN_MSG_LENGTH (sizeof(msg_t))
 
+/*Size of scratch buffer used to discard truncated payload*/
+#define DRAIN_BUFFER_SIZE 4096
+
 /**
  * For debugging purpose to print 
  * MPI_Datatype in string form.
@@ -30,7 +34,12 @@ char *mympi_datatypes[] = {
 
 char *mympi_types[] = {
     "MSG_INIT",
-    "MSG_DATA"
+    "MSG_DATA",
+    "MSG_TABLE",
+    "MSG_RTS",
+    "MSG_CTS",
+    "MSG_RDATA",
+    "MSG_CHUNK"
 };
 
 /**
@@ -39,7 +48,6 @@ char *mympi_types[] = {
  */
 void __htonmsg(msg_t * msg);
 void __ntohmsg(msg_t * msg);
-uint32_t __getipaddress(char *hostname);
 
 /**
  * This is used for purpose of data ordering to common format.
@@ -57,37 +65,184 @@ static inline int is_little_endian()
 }
 
 /*
- * Free alloacted memory for message.
+ * Message pool.
+ *
+ * Message buffers are recycled through power-of-two size classes instead
+ * of going to malloc/free for every message. Each thread owns its own
+ * cache, so no locking is needed. Every class keeps at most
+ * MSG_POOL_HIGH_WATER free buffers and the whole cache is bounded by
+ * MSG_POOL_MAX_CACHED_BYTES; buffers beyond that are returned to libc.
+ * Messages larger than the biggest class bypass the pool.
  */
-static inline void __free_msg(msg_t * msg)
+#define MSG_POOL_MIN_SHIFT        6	/*smallest class 64 bytes */
+#define MSG_POOL_MAX_SHIFT        22	/*largest class 4 MB */
+#define MSG_POOL_NR_CLASSES       (MSG_POOL_MAX_SHIFT - MSG_POOL_MIN_SHIFT + 1)
+#define MSG_POOL_HIGH_WATER       32	/*free buffers cached per class */
+#define MSG_POOL_MAX_CACHED_BYTES (16 << 20)	/*bound on cached memory */
+#define MSG_POOL_NO_CLASS         ((uint32_t) -1)
+
+/*Pool bookkeeping stored in front of each message*/
+struct msg_block {
+    struct msg_block *next;	/*next free block in the class */
+    uint32_t size_class;	/*size class or MSG_POOL_NO_CLASS */
+    uint32_t padding;		/*padding */
+    msg_t msg;			/*message handed out to callers */
+};
+
+#define MSG_BLOCK_OVERHEAD        OFFSETOF(struct msg_block, msg)
+#define MSG_TO_BLOCK(m) \
+	((struct msg_block *) ((char *) (m) - MSG_BLOCK_OVERHEAD))
+
+/*Per thread message cache*/
+struct msg_pool {
+    struct msg_block *free_list[MSG_POOL_NR_CLASSES];
+    unsigned int nr_free[MSG_POOL_NR_CLASSES];
+    struct msg_pool_stats stats;
+};
+
+static __thread struct msg_pool msg_pool;
+
+/*
+ * Returns size class for a block of size bytes or MSG_POOL_NO_CLASS if
+ * the block is too big to be pooled.
+ */
+static inline uint32_t __msg_pool_class(size_t size)
 {
-    if (msg != NULL) {
-	free(msg);
+    uint32_t size_class = 0;
+
+    while (((size_t) 1 << (size_class + MSG_POOL_MIN_SHIFT)) < size) {
+	size_class++;
+	if (size_class >= MSG_POOL_NR_CLASSES) {
+	    return MSG_POOL_NO_CLASS;
+	}
     }
+    return size_class;
 }
 
 /**
- * This function allocates message object of size payload length
+ * This function hands out message buffer with room for payload_length
+ * bytes of payload.
  */
-static inline int allocate_msg(msg_t ** pMsg, int payload_length)
+int acquire_msg(msg_t ** pMsg, unsigned int payload_length)
 {
-    //check arguments 
     if (pMsg == NULL) {
 	return MSG_INVALID_ARG;
     }
 
-    int total_msg_size = sizeof(msg_t) + payload_length;
-    //allocate memory for msg
-    *pMsg = (msg_t *) malloc(total_msg_size);
+    size_t size = MSG_BLOCK_OVERHEAD + MSG_SIZE(payload_length);
+    uint32_t size_class = __msg_pool_class(size);
+    struct msg_block *block = NULL;
+
+    if (size_class != MSG_POOL_NO_CLASS) {
+	block = msg_pool.free_list[size_class];
+	if (block) {
+	    //reuse cached buffer
+	    msg_pool.free_list[size_class] = block->next;
+	    msg_pool.nr_free[size_class]--;
+	    msg_pool.stats.cached_bytes -=
+		(size_t) 1 << (size_class + MSG_POOL_MIN_SHIFT);
+	    msg_pool.stats.hits++;
+	} else {
+	    //allocate whole class so that buffer can be reused
+	    size = (size_t) 1 << (size_class + MSG_POOL_MIN_SHIFT);
+	}
+    }
+    if (!block) {
+	msg_pool.stats.misses++;
+	block = (struct msg_block *) malloc(size);
+	if (!block) {
+	    *pMsg = NULL;
+	    return MSG_ERROR;
+	}
+	block->size_class = size_class;
+    }
+    block->next = NULL;
 
-    //initialize memory
-    memset(*pMsg, 0, total_msg_size);
+    //only header is initialized, payload is always overwritten by caller
+    *pMsg = &block->msg;
+    memset(*pMsg, 0, MIN_MSG_LENGTH);
 
-    if (*pMsg == NULL) {
-	return MSG_ERROR;
+    return MSG_SUCCESS;
+}
+
+/**
+ * This function hands message buffer back to the pool.
+ */
+void release_msg(msg_t * msg)
+{
+    if (msg == NULL) {
+	return;
     }
 
-    return MSG_SUCCESS;
+    struct msg_block *block = MSG_TO_BLOCK(msg);
+    uint32_t size_class = block->size_class;
+    msg_pool.stats.releases++;
+
+    if (size_class != MSG_POOL_NO_CLASS) {
+	size_t size = (size_t) 1 << (size_class + MSG_POOL_MIN_SHIFT);
+	if (msg_pool.nr_free[size_class] < MSG_POOL_HIGH_WATER &&
+	    msg_pool.stats.cached_bytes + size <=
+	    MSG_POOL_MAX_CACHED_BYTES) {
+	    //keep buffer for later reuse
+	    block->next = msg_pool.free_list[size_class];
+	    msg_pool.free_list[size_class] = block;
+	    msg_pool.nr_free[size_class]++;
+	    msg_pool.stats.cached_bytes += size;
+	    return;
+	}
+    }
+    //pool is above its high water mark
+    msg_pool.stats.drops++;
+    free(block);
+}
+
+/**
+ * This function returns pool counters of calling thread.
+ */
+void msg_pool_get_stats(struct msg_pool_stats *stats)
+{
+    if (stats) {
+	*stats = msg_pool.stats;
+    }
+}
+
+/**
+ * This function frees all buffers cached by calling thread.
+ */
+void msg_pool_drain(void)
+{
+    int i;
+    struct msg_block *block;
+
+    for (i = 0; i < MSG_POOL_NR_CLASSES; i++) {
+	while ((block = msg_pool.free_list[i]) != NULL) {
+	    msg_pool.free_list[i] = block->next;
+	    free(block);
+	}
+	msg_pool.nr_free[i] = 0;
+    }
+    msg_pool.stats.cached_bytes = 0;
+}
+
+/*
+ * Free alloacted memory for message.
+ */
+static inline void __free_msg(msg_t * msg)
+{
+    release_msg(msg);
+}
+
+/**
+ * This function allocates message object of size payload length
+ */
+static inline int allocate_msg(msg_t ** pMsg, int payload_length)
+{
+    //check arguments 
+    if (pMsg == NULL || payload_length < 0) {
+	return MSG_INVALID_ARG;
+    }
+
+    return acquire_msg(pMsg, payload_length);
 }
 
 /**
@@ -99,7 +254,7 @@ static inline int allocate_msg(msg_t ** pMsg, int payload_length)
 int readn(int fd, void *vptr, unsigned int n)
 {
     unsigned int nleft;
-    unsigned int nread;
+    ssize_t nread;
     char *ptr;
 
     ptr = vptr;
@@ -151,6 +306,41 @@ int writen(int fd, const void *vptr, unsigned int n)
     return (n);
 }
 
+/*
+ * This function will take care of sending scatter/gather vector
+ * over fd. Partially written vectors are advanced in place, so
+ * iov is modified.
+ */
+int writevn(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nwritten;
+    int total = 0;
+
+    while (iovcnt > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return MSG_ERROR;
+	}
+	total += nwritten;
+
+	//skip completely written vectors
+	while (iovcnt > 0 && (size_t) nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	//advance partially written vector
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *) iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+
+    return total;
+}
+
 /**
  * This function reads message object from descriptor
  * and returns message object.
@@ -168,44 +358,109 @@ int read_msg(int fd, msg_t ** pMsg)
     if (!fd) {
 	return MSG_ERROR;
     }
-    //message payload length
-    int msg_length;
-
-    //read length of the message
-    if (read(fd, &msg_length, LENGTH_SIZE) != LENGTH_SIZE) {
-	dprintf("Failed to read length \n");
+    //read fixed size header first
+    msg_t hdr;
+    if (read_msg_hdr(fd, &hdr) != MSG_SUCCESS) {
+	dprintf("Failed to read message header\n");
 	return MSG_ERROR;
     }
-    //allocate memory for local buffer of message length size
-    char *msg_buffer = (char *) malloc(MSG_SIZE(msg_length));
-    if (!msg_buffer) {
+    //allocate message of payload size
+    if (allocate_msg(pMsg, hdr.length) != MSG_SUCCESS) {
 	dprintf
-	    ("Failed to allocate memory for local buffer of size %lu \n",
-	     MSG_SIZE(msg_length));
+	    ("Failed to allocate memory for message of size %lu \n",
+	     MSG_SIZE(hdr.length));
+	return MSG_ERROR;
+    }
+    memcpy(*pMsg, &hdr, MIN_MSG_LENGTH);
+
+    //read payload straight into message
+    if (read_msg_payload(fd, &hdr, (*pMsg)->payload, hdr.length, NULL)
+	!= MSG_SUCCESS) {
+	dprintf("failed to read %d bytes\n", hdr.length);
+	__free_msg(*pMsg);
+	*pMsg = NULL;
 	return MSG_ERROR;
     }
-    //copy length to msg_buffer
-    memcpy(msg_buffer, &msg_length, LENGTH_SIZE);
 
-    //read entire message from the buffer
-    if (readn
-	(fd, msg_buffer + LENGTH_SIZE,
-	 MSG_SIZE(msg_length - LENGTH_SIZE)) !=
-	(MSG_SIZE(msg_length - LENGTH_SIZE))) {
-	dprintf("failed to read %d bytes\n", msg_length);
+    return MSG_SUCCESS;
+}
+
+/**
+ * This function reads message header from descriptor.
+ */
+int read_msg_hdr(int fd, msg_t * hdr)
+{
+    if (!fd || !hdr) {
 	return MSG_ERROR;
     }
-    //parse the buffer into message
-    if (parse_msg(msg_buffer, msg_length, pMsg) != MSG_SUCCESS) {
-	dprintf("failed to parse message\n");
+    //read the whole fixed size header
+    int nread = readn(fd, hdr, MIN_MSG_LENGTH);
+    if (nread == 0) {
+	dprintf("Connection closed by peer fd:%d\n", fd);
+	return MSG_CONN_CLOSED;
+    } else if (nread != MIN_MSG_LENGTH) {
+	dprintf("Failed to read message header\n");
 	return MSG_ERROR;
     }
-    //clean up memory
-    free(msg_buffer);
+    //validate header
+    if (hdr->type & MSG_INIT) {
+	if (hdr->length != 0) {
+	    return MSG_INVALID_INIT_MSG;
+	}
+    } else if (hdr->type & MSG_TABLE) {
+	if (hdr->length % sizeof(struct init_hdr) != 0) {
+	    return MSG_INVALID_MSG;
+	}
+    } else if (hdr->type & (MSG_RTS | MSG_CTS)) {
+	if (hdr->length != 0) {
+	    return MSG_INVALID_MSG;
+	}
+    } else if (!(hdr->type & (MSG_DATA | MSG_RDATA))) {
+	return MSG_INVALID_MSG;
+    }
 
     return MSG_SUCCESS;
 }
 
+/**
+ * This function reads message payload into buffer of capacity bytes.
+ */
+int read_msg_payload(int fd, msg_t * hdr, void *buffer,
+		     unsigned int capacity, unsigned int *received)
+{
+    if (!fd || !hdr || (capacity > 0 && !buffer)) {
+	return MSG_ERROR;
+    }
+
+    unsigned int nbytes = hdr->length < capacity ? hdr->length : capacity;
+
+    //read payload directly into the buffer
+    if (nbytes > 0 && readn(fd, buffer, nbytes) != nbytes) {
+	dprintf("failed to read %u bytes\n", nbytes);
+	return MSG_ERROR;
+    }
+    if (received) {
+	*received = nbytes;
+    }
+    if (nbytes == hdr->length) {
+	return MSG_SUCCESS;
+    }
+    //discard rest of the payload which does not fit in buffer
+    char scratch[DRAIN_BUFFER_SIZE];
+    unsigned int nleft = hdr->length - nbytes;
+    while (nleft > 0) {
+	unsigned int chunk =
+	    nleft < DRAIN_BUFFER_SIZE ? nleft : DRAIN_BUFFER_SIZE;
+	if (readn(fd, scratch, chunk) != chunk) {
+	    dprintf("failed to drain %u bytes\n", chunk);
+	    return MSG_ERROR;
+	}
+	nleft -= chunk;
+    }
+
+    return MSG_TRUNCATED;
+}
+
 
 /**
  * This function sends message object over descriptor.
@@ -232,6 +487,136 @@ int send_msg(int fd, msg_t * pMsg)
     return MSG_SUCCESS;
 }
 
+/**
+ * This function fills in data message header.
+ */
+void build_data_hdr(msg_t * hdr, MPI_Datatype datatype, unsigned int tag,
+		    unsigned int length)
+{
+    memset(hdr, 0, MIN_MSG_LENGTH);
+    hdr->length = length;
+    hdr->type = MSG_DATA;
+    hdr->data.datatype = datatype;
+    hdr->data.tag = tag;
+}
+
+/**
+ * This function fills in rendezvous message header.
+ */
+void build_rndv_hdr(msg_t * hdr, unsigned int type, unsigned int tag,
+		    unsigned int id, unsigned int size, unsigned int length)
+{
+    memset(hdr, 0, MIN_MSG_LENGTH);
+    hdr->length = length;
+    hdr->type = type;
+    hdr->rndv.tag = tag;
+    hdr->rndv.id = id;
+    hdr->rndv.size = size;
+}
+
+void build_chunk_hdr(msg_t * hdr, unsigned int id, unsigned int offset,
+		     unsigned int size, unsigned int length)
+{
+    memset(hdr, 0, MIN_MSG_LENGTH);
+    hdr->length = length;
+    hdr->type = MSG_CHUNK;
+    hdr->chunk.offset = offset;
+    hdr->chunk.id = id;
+    hdr->chunk.size = size;
+}
+
+/**
+ * This function writes scatter/gather vector to non-blocking descriptor.
+ * MSG_NOSIGNAL keeps a closed peer from raising SIGPIPE.
+ */
+int write_iov(int fd, struct iovec **iov, int *iovcnt)
+{
+    struct msghdr msg;
+    ssize_t nwritten;
+
+    while (*iovcnt > 0) {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = *iov;
+	msg.msg_iovlen = *iovcnt;
+	if ((nwritten = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		return MSG_AGAIN;
+	    }
+	    return MSG_ERROR;
+	}
+	//skip completely written vectors
+	while (*iovcnt > 0 && (size_t) nwritten >= (*iov)->iov_len) {
+	    nwritten -= (*iov)->iov_len;
+	    (*iov)++;
+	    (*iovcnt)--;
+	}
+	//advance partially written vector
+	if (*iovcnt > 0) {
+	    (*iov)->iov_base = (char *) (*iov)->iov_base + nwritten;
+	    (*iov)->iov_len -= nwritten;
+	}
+    }
+
+    return MSG_SUCCESS;
+}
+
+/**
+ * This function reads available data from non-blocking descriptor.
+ */
+int read_avail(int fd, void *buffer, unsigned int n)
+{
+    ssize_t nread;
+
+    while ((nread = read(fd, buffer, n)) < 0) {
+	if (errno == EINTR) {
+	    continue;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	    return MSG_AGAIN;
+	}
+	return MSG_ERROR;
+    }
+    if (nread == 0 && n > 0) {
+	return MSG_CONN_CLOSED;
+    }
+    return nread;
+}
+
+/**
+ * This function sends data message over descriptor. Header is written
+ * from stack and payload straight from user buffer.
+ */
+int send_data_msg(int fd, MPI_Datatype datatype, unsigned int tag,
+		  void *buffer, int length)
+{
+    if (!fd) {
+	return MSG_ERROR;
+    }
+    if (length < 0 || (length > 0 && !buffer)) {
+	return MSG_INVALID_ARG;
+    }
+    //build header on stack
+    msg_t hdr;
+    build_data_hdr(&hdr, datatype, tag, length);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = MIN_MSG_LENGTH;
+    iov[1].iov_base = buffer;
+    iov[1].iov_len = length;
+
+    //write header and payload in one go
+    if (writevn(fd, iov, 2) != MSG_SIZE(length)) {
+	dprintf("Failed to write data of size:%lu \n", MSG_SIZE(length));
+	return MSG_ERROR;
+    }
+
+    return MSG_SUCCESS;
+}
+
 /**
  * Fill in msg structure by parsing buffer upto size length.
  */
@@ -271,6 +656,16 @@ int parse_msg(void *buffer, unsigned int length, msg_t ** pMsg)
 	       DATATYPE_SIZE);
 	memcpy(&(msg->data.tag), buffer + DATA_HDR_TAG_OFFSET, TAG_SIZE);
 	memcpy(&(msg->payload), buffer + DATA_PAYLOAD_OFFSET, length);
+    } else if (msg->type & MSG_TABLE) {
+	//check payload length
+	if (msg->length != length
+	    || length % sizeof(struct init_hdr) != 0) {
+	    return MSG_INVALID_MSG;
+	}
+	//copy sender init hdr fields and address entries
+	memcpy(&(msg->init), buffer + INIT_HDR_RANK_OFFSET,
+	       sizeof(struct init_hdr));
+	memcpy(&(msg->payload), buffer + DATA_PAYLOAD_OFFSET, length);
     } else {
 	return MSG_INVALID_MSG;
     }
@@ -284,7 +679,7 @@ int parse_msg(void *buffer, unsigned int length, msg_t ** pMsg)
  * This function populates msg structure and converts each of the
  * data type to network byte order.
  */
-int create_init_msg(int rank, int port, msg_t ** pMsg)
+int create_init_msg(int rank, uint32_t address, int port, msg_t ** pMsg)
 {
     int status = allocate_msg(pMsg, 0);
     if (status != MSG_SUCCESS) {
@@ -297,13 +692,42 @@ int create_init_msg(int rank, int port, msg_t ** pMsg)
     msg->type = MSG_INIT;
     msg->init.port = port;
     msg->init.rank = rank;
-    msg->init.address = __getipaddress("127.0.0.1");
+    msg->init.address = address;
+    msg->init.flags = 0;
 
     //convert to network byte order  
     //__htonmsg(msg);
     return 0;
 }
 
+/*
+ * This function populates address table message.
+ */
+int create_table_msg(int rank, struct init_hdr *entries, int nr_entries,
+		     msg_t ** pMsg)
+{
+    if (!entries || nr_entries <= 0) {
+	return MSG_INVALID_ARG;
+    }
+
+    int length = sizeof(struct init_hdr) * nr_entries;
+    int status = allocate_msg(pMsg, length);
+    if (status != MSG_SUCCESS) {
+	return status;
+    }
+    msg_t *msg = *pMsg;
+
+    msg->length = length;
+    msg->type = MSG_TABLE;
+    msg->init.rank = rank;
+    msg->init.address = 0;
+    msg->init.port = 0;
+    msg->init.flags = 0;
+    memcpy(&(msg->payload), entries, length);
+
+    return 0;
+}
+
 /*
  * This function populates msg structure and converts each of the
  * data type to network byte order except for payload.
@@ -389,7 +813,7 @@ uint32_t __getipaddress(char *hostname)
     int rv;
 
     memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;	// use AF_INET6 to force IPv6
+    hints.ai_family = AF_INET;	// addresses are exchanged as IPv4
     hints.ai_socktype = SOCK_STREAM;
 
     if ((rv = getaddrinfo(hostname, "http", &hints, &servinfo)) != 0) {
@@ -397,6 +821,7 @@ uint32_t __getipaddress(char *hostname)
 	return 0;
     }
     // loop through all the results and connect to the first we can
+    ip = 0;
     for (p = servinfo; p != NULL; p = p->ai_next) {
 	h = (struct sockaddr_in *) p->ai_addr;
 	ip = h->sin_addr.s_addr;
@@ -426,6 +851,21 @@ void print_msg_hdr(msg_t * msg)
 	dprintf("type:%s\n", mympi_types[1]);
 	dprintf("tag:%u\n", msg->data.tag);
 	dprintf("datatype:%s\n", mympi_datatypes[msg->data.datatype]);
+    } else if (msg->type & MSG_TABLE) {
+	dprintf("type:%s\n", mympi_types[2]);
+	dprintf("rank:%u\n", msg->init.rank);
+	dprintf("entries:%lu\n", msg->length / sizeof(struct init_hdr));
+    } else if (msg->type & (MSG_RTS | MSG_CTS | MSG_RDATA)) {
+	dprintf("type:%s\n", mympi_types[msg->type & MSG_RTS ? 3 :
+					   msg->type & MSG_CTS ? 4 : 5]);
+	dprintf("tag:%u\n", msg->rndv.tag);
+	dprintf("id:%u\n", msg->rndv.id);
+	dprintf("size:%u\n", msg->rndv.size);
+    } else if (msg->type & MSG_CHUNK) {
+	dprintf("type:%s\n", mympi_types[6]);
+	dprintf("offset:%u\n", msg->chunk.offset);
+	dprintf("id:%u\n", msg->chunk.id);
+	dprintf("size:%u\n", msg->chunk.size);
     } else {
 	dprintf("Invalid message:%p\n", msg);
     }
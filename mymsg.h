@@ -6,6 +6,7 @@
 
 #include "mympidatatype.h"
 #include <stdint.h>
+#include <sys/uio.h>
 
 /*Message error codes*/
 #define MSG_SUCCESS           0
@@ -15,10 +16,18 @@
 #define MSG_INVALID_INIT_MSG -4
 #define MSG_INVALID_DATA_MSG -5
 #define MSG_INVALID_MSG      -6
+#define MSG_TRUNCATED        -7
+#define MSG_CONN_CLOSED      -8
+#define MSG_AGAIN            -9
 
 /*Message types*/
 #define MSG_INIT    1		//Initialization message
 #define MSG_DATA    2		//Data message
+#define MSG_TABLE   4		//Address table message
+#define MSG_RTS     8		//Rendezvous request to send
+#define MSG_CTS     16		//Rendezvous clear to send
+#define MSG_RDATA   32		//Rendezvous data message
+#define MSG_CHUNK   64		//Chunk of striped rendezvous data
 
 extern char *mympi_types[];
 
@@ -31,9 +40,21 @@ struct init_hdr {
     uint32_t rank;		/*rank of the processor */
     uint32_t address;		/*Internet address */
     uint16_t port;		/*port number of listening server of the processor */
-    uint16_t padding;		/*padding */
+    uint16_t flags;		/*INIT_FLAG_* connection options */
 };
 
+/*Connection options of init message*/
+#define INIT_FLAG_SHM     1	/*use shared memory channel, see myshm.h */
+#define INIT_FLAG_STRIPE  2	/*extra stream of striped messages */
+
+/*Extra streams carry their number in the high byte of the flags*/
+#define INIT_STRIPE_SHIFT 8
+
+/*
+ * Address table message reuses init header for the sender and carries
+ * one struct init_hdr per processor, indexed by rank, as payload.
+ */
+
 /*Data message header*/
 struct data_hdr {
     uint32_t tag;		/*tag */
@@ -41,8 +62,45 @@ struct data_hdr {
     uint32_t datatype;		/*Data type of the message */
 };
 
+/*
+ * Rendezvous message header
+ *
+ * Messages above the eager limit are not sent right away. Sender announces
+ * them with MSG_RTS carrying tag, its own id for the message and size.
+ * Once the receiver has matched it, it answers with MSG_CTS carrying the
+ * same id and the number of bytes it can take, and the sender streams that
+ * many bytes as payload of MSG_RDATA with the same id. tag is at the same
+ * offset as in the data header so both can be matched alike.
+ */
+struct rndv_hdr {
+    uint32_t tag;		/*tag */
+    uint32_t id;		/*sender id of the message */
+    uint32_t size;		/*message size in bytes */
+};
 
-/*Message format*/
+/*
+ * Chunk message header
+ *
+ * Payload of a large message may be striped over several streams instead
+ * of being sent as one MSG_RDATA. Every piece travels as MSG_CHUNK with the
+ * id of the message, the offset of the piece and the accepted size of the
+ * whole message, so the receiver can place pieces arriving in any order.
+ */
+struct chunk_hdr {
+    uint32_t offset;		/*offset of the piece in the message */
+    uint32_t id;		/*sender id of the message */
+    uint32_t size;		/*accepted message size in bytes */
+};
+
+
+/*
+ * Message format
+ *
+ * Messages are self-delimiting: the fixed size header carries the payload
+ * length, so messages written back to back, such as a batch of coalesced
+ * small messages, are split back out by reading header after header and
+ * need no framing of their own.
+ */
 struct __msg_t {
     uint32_t length;		/*payload length of the message */
     uint32_t type;		/*type of the message to be exchanged */
@@ -53,6 +111,8 @@ struct __msg_t {
     union {
 	struct init_hdr init;	/*initialization message header */
 	struct data_hdr data;	/*data message header */
+	struct rndv_hdr rndv;	/*rendezvous message header */
+	struct chunk_hdr chunk;	/*chunk message header */
     };
     char payload[0];
 };
@@ -95,10 +155,20 @@ typedef struct __msg_t msg_t;
 /*Calculate message size from length of payload*/
 #define MSG_SIZE(x) ((MIN_MSG_LENGTH) + (x))
 
+/*Message pool counters*/
+struct msg_pool_stats {
+    unsigned long hits;		/*requests served from the pool */
+    unsigned long misses;	/*requests that went to malloc */
+    unsigned long releases;	/*buffers handed back */
+    unsigned long drops;	/*buffers freed above high water mark */
+    unsigned long cached_bytes;	/*bytes currently held by the pool */
+};
+
 /*
  * This function creates initialization message.
  * Input parameters
  *    rank    processor rank
+ *    address ip address of processor in host byte order
  *    port    server port of processor
  * Output parameters
  *    msg     message
@@ -106,7 +176,29 @@ typedef struct __msg_t msg_t;
  *   MSG_SUCCESS on successful creation of message
  *   MSG_ERROR   on error 
  */
-int create_init_msg(int /*rank */ , int /*port */ , msg_t ** /*msg */ );
+int create_init_msg(int /*rank */ , uint32_t /*address */ , int /*port */ ,
+		    msg_t ** /*msg */ );
+
+/*
+ * This function creates address table message.
+ * Input parameters
+ *    rank        rank of sending processor
+ *    entries     address entries of all processors indexed by rank
+ *    nr_entries  number of entries
+ * Output parameters
+ *    msg         message
+ * Return value
+ *   MSG_SUCCESS on successful creation of message
+ *   MSG_ERROR   on error 
+ */
+int create_table_msg(int /*rank */ , struct init_hdr * /*entries */ ,
+		     int /*nr_entries */ , msg_t ** /*msg */ );
+
+/*
+ * This function resolves hostname to ip address in network byte order.
+ * Returns 0 if hostname cannot be resolved.
+ */
+uint32_t __getipaddress(char * /*hostname */ );
 
 /*
  * This function creates data message.
@@ -125,6 +217,65 @@ int create_data_msg(MPI_Datatype /*datatype */ , unsigned int /*tag */ ,
 		    void * /*buffer */ , int /*length */ ,
 		    msg_t ** /*msg */ );
 
+/*
+ * This function fills in header of a data message.
+ * Input parameters
+ *      datatype datatype of message
+ *      tag      message tag
+ *      length   payload length
+ * Output parameters
+ *      hdr      message header
+ */
+void build_data_hdr(msg_t * /*hdr */ , MPI_Datatype /*datatype */ ,
+		    unsigned int /*tag */ , unsigned int /*length */ );
+
+/*
+ * This function fills in header of a rendezvous message.
+ * Input parameters
+ *      type     MSG_RTS, MSG_CTS or MSG_RDATA
+ *      tag      message tag
+ *      id       sender id of the message
+ *      size     message size for MSG_RTS, accepted size for MSG_CTS
+ *      length   payload length, only MSG_RDATA has payload
+ * Output parameters
+ *      hdr      message header
+ */
+void build_rndv_hdr(msg_t * /*hdr */ , unsigned int /*type */ ,
+		    unsigned int /*tag */ , unsigned int /*id */ ,
+		    unsigned int /*size */ , unsigned int /*length */ );
+
+/*
+ * This function fills in header of a chunk of a striped message.
+ * Input parameters
+ *      id       sender id of the message
+ *      offset   offset of the chunk in the message
+ *      size     accepted size of the whole message
+ *      length   payload length of the chunk
+ * Output parameters
+ *      hdr      message header
+ */
+void build_chunk_hdr(msg_t * /*hdr */ , unsigned int /*id */ ,
+		     unsigned int /*offset */ , unsigned int /*size */ ,
+		     unsigned int /*length */ );
+
+/*
+ * This function sends data message over descriptor without copying the
+ * payload. Message header is built on stack and written together with
+ * the user buffer using a single vectored write.
+ * Input parameters
+ *      fd       descriptor to write message to
+ *      datatype datatype of message
+ *      tag      message tag
+ *      buffer   payload data
+ *      length   payload length
+ * Return value
+ *     MSG_SUCCESS on successful send
+ *     MSG_ERROR   on error
+ */
+int send_data_msg(int /*fd */ , MPI_Datatype /*datatype */ ,
+		  unsigned int /*tag */ , void * /*buffer */ ,
+		  int /*length */ );
+
 /*
  * This function parses message. 
  * Input parametes
@@ -166,11 +317,101 @@ int send_msg(int /*fd */ , msg_t * /*pMsg */ );
  */
 int read_msg(int /*fd */ , msg_t ** /*pMsg */ );
 
+/**
+ * This function reads only the fixed size message header from descriptor
+ * into caller provided storage. Payload, if any, is left on the descriptor
+ * and must be consumed with read_msg_payload.
+ *
+ * Input parameters
+ * 	fd   descriptor to read message header from
+ * Output parameters
+ * 	hdr  message header
+ * Return value
+ * 	returns MSG_SUCCESS on successful receive, MSG_INVALID_MSG or
+ * 	MSG_INVALID_INIT_MSG on malformed header, MSG_CONN_CLOSED if peer
+ * 	closed the connection or MSG_ERROR on failure.
+ */
+int read_msg_hdr(int /*fd */ , msg_t * /*hdr */ );
+
+/**
+ * This function reads payload of message whose header was read with
+ * read_msg_hdr straight into the caller buffer. Payload beyond capacity
+ * is drained from descriptor and discarded.
+ *
+ * Input parameters
+ * 	fd        descriptor to read payload from
+ * 	hdr       header of the message
+ * 	buffer    destination buffer
+ * 	capacity  size of destination buffer in bytes
+ * Output parameters
+ * 	received  number of bytes copied to buffer
+ * Return value
+ * 	returns MSG_SUCCESS on successful receive, MSG_TRUNCATED when
+ * 	payload did not fit into buffer or MSG_ERROR in case of failure.
+ */
+int read_msg_payload(int /*fd */ , msg_t * /*hdr */ , void * /*buffer */ ,
+		     unsigned int /*capacity */ ,
+		     unsigned int * /*received */ );
+
+/**
+ * This function writes as much of a scatter/gather vector as the
+ * non-blocking descriptor accepts. Written vectors are skipped and a
+ * partially written vector is advanced in place.
+ *
+ * Input/Output parameters
+ * 	iov      next vector to write
+ * 	iovcnt   number of vectors left
+ * Return value
+ * 	returns MSG_SUCCESS once everything is written, MSG_AGAIN if the
+ * 	descriptor is full or MSG_ERROR in case of failure.
+ */
+int write_iov(int /*fd */ , struct iovec ** /*iov */ , int * /*iovcnt */ );
+
+/**
+ * This function reads whatever is available, up to n bytes, from
+ * non-blocking descriptor.
+ *
+ * Return value
+ * 	returns number of bytes read, MSG_AGAIN if nothing is available,
+ * 	MSG_CONN_CLOSED if peer closed the connection or MSG_ERROR.
+ */
+int read_avail(int /*fd */ , void * /*buffer */ , unsigned int /*n */ );
+
 /**
  * This is an utility function to prints message header.
  */
 void print_msg_hdr(msg_t * msg);
 
+/*
+ * This function hands out a message buffer from the message pool. Only
+ * the header is zeroed, payload contents are undefined.
+ * Input parameters
+ *      payload_length  payload length
+ * Output parameters
+ *      msg             message
+ * Return value
+ *     MSG_SUCCESS on success
+ *     MSG_ERROR   on allocation failure
+ */
+int acquire_msg(msg_t ** /*msg */ , unsigned int /*payload_length */ );
+
+/*
+ * This function hands message buffer obtained from acquire_msg,
+ * read_msg or create_xxx_msg back to the message pool.
+ */
+void release_msg(msg_t * /*msg */ );
+
+/*
+ * This function reports message pool counters of the calling thread.
+ */
+void msg_pool_get_stats(struct msg_pool_stats * /*stats */ );
+
+/*
+ * This function frees all buffers cached in message pool of the calling
+ * thread.
+ */
+void msg_pool_drain(void);
+
 /*
  * This function free's data for init message.
  */
@@ -0,0 +1,179 @@
+/**
+ * Implementation of reduction kernels.
+ *
+ * Each kernel exists in a scalar version and, on x86, in SSE and AVX2
+ * versions compiled for their instruction set with target attributes so
+ * the rest of the library still runs on any processor. Vector loops
+ * handle whole vectors with unaligned loads and leave the tail to the
+ * scalar loop.
+ */
+#include "myop.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OP_X86 1
+#endif
+
+/*Scalar combine expressions*/
+#define SCALAR_SUM(a, b)     ((a) + (b))
+#define SCALAR_MAX(a, b)     ((a) > (b) ? (a) : (b))
+#define SCALAR_MIN(a, b)     ((a) < (b) ? (a) : (b))
+#define SCALAR_PROD(a, b)    ((a) * (b))
+
+/*
+ * Defines scalar kernel name combining arrays of type with expr.
+ */
+#define SCALAR_KERNEL(name, type, expr)					\
+static void name(void *inout, const void *in, unsigned int count)	\
+{									\
+    type *a = (type *) inout;						\
+    const type *b = (const type *) in;					\
+    unsigned int i;							\
+									\
+    for (i = 0; i < count; i++) {					\
+	a[i] = expr(a[i], b[i]);					\
+    }									\
+}
+
+SCALAR_KERNEL(__sum_int, int, SCALAR_SUM)
+SCALAR_KERNEL(__max_int, int, SCALAR_MAX)
+SCALAR_KERNEL(__min_int, int, SCALAR_MIN)
+SCALAR_KERNEL(__prod_int, int, SCALAR_PROD)
+SCALAR_KERNEL(__sum_double, double, SCALAR_SUM)
+SCALAR_KERNEL(__max_double, double, SCALAR_MAX)
+SCALAR_KERNEL(__min_double, double, SCALAR_MIN)
+SCALAR_KERNEL(__prod_double, double, SCALAR_PROD)
+
+#ifdef OP_X86
+/*
+ * Defines vector kernel name for instruction set isa. width elements of
+ * type are combined at once with vop on vectors of vtype, which are moved
+ * with load and store.
+ */
+#define VECTOR_KERNEL(name, isa, type, vtype, width, load, store, vop, expr) \
+__attribute__ ((target(isa)))						\
+static void name(void *inout, const void *in, unsigned int count)	\
+{									\
+    type *a = (type *) inout;						\
+    const type *b = (const type *) in;					\
+    unsigned int i;							\
+									\
+    for (i = 0; i + (width) <= count; i += (width)) {			\
+	vtype va = load((void *) (a + i));				\
+	vtype vb = load((void *) (b + i));				\
+	store((void *) (a + i), vop(va, vb));				\
+    }									\
+    for (; i < count; i++) {						\
+	a[i] = expr(a[i], b[i]);					\
+    }									\
+}
+
+/*Loads and stores of integer vectors take vector pointers*/
+#define LOADU_SI128(p)       _mm_loadu_si128((const __m128i *) (p))
+#define STOREU_SI128(p, v)   _mm_storeu_si128((__m128i *) (p), (v))
+#define LOADU_SI256(p)       _mm256_loadu_si256((const __m256i *) (p))
+#define STOREU_SI256(p, v)   _mm256_storeu_si256((__m256i *) (p), (v))
+#define LOADU_PD(p)          _mm_loadu_pd((const double *) (p))
+#define STOREU_PD(p, v)      _mm_storeu_pd((double *) (p), (v))
+#define LOADU_PD256(p)       _mm256_loadu_pd((const double *) (p))
+#define STOREU_PD256(p, v)   _mm256_storeu_pd((double *) (p), (v))
+
+VECTOR_KERNEL(__sum_int_sse, "sse4.1", int, __m128i, 4, LOADU_SI128,
+	      STOREU_SI128, _mm_add_epi32, SCALAR_SUM)
+VECTOR_KERNEL(__max_int_sse, "sse4.1", int, __m128i, 4, LOADU_SI128,
+	      STOREU_SI128, _mm_max_epi32, SCALAR_MAX)
+VECTOR_KERNEL(__min_int_sse, "sse4.1", int, __m128i, 4, LOADU_SI128,
+	      STOREU_SI128, _mm_min_epi32, SCALAR_MIN)
+VECTOR_KERNEL(__prod_int_sse, "sse4.1", int, __m128i, 4, LOADU_SI128,
+	      STOREU_SI128, _mm_mullo_epi32, SCALAR_PROD)
+VECTOR_KERNEL(__sum_double_sse, "sse4.1", double, __m128d, 2, LOADU_PD,
+	      STOREU_PD, _mm_add_pd, SCALAR_SUM)
+VECTOR_KERNEL(__max_double_sse, "sse4.1", double, __m128d, 2, LOADU_PD,
+	      STOREU_PD, _mm_max_pd, SCALAR_MAX)
+VECTOR_KERNEL(__min_double_sse, "sse4.1", double, __m128d, 2, LOADU_PD,
+	      STOREU_PD, _mm_min_pd, SCALAR_MIN)
+VECTOR_KERNEL(__prod_double_sse, "sse4.1", double, __m128d, 2, LOADU_PD,
+	      STOREU_PD, _mm_mul_pd, SCALAR_PROD)
+
+VECTOR_KERNEL(__sum_int_avx2, "avx2", int, __m256i, 8, LOADU_SI256,
+	      STOREU_SI256, _mm256_add_epi32, SCALAR_SUM)
+VECTOR_KERNEL(__max_int_avx2, "avx2", int, __m256i, 8, LOADU_SI256,
+	      STOREU_SI256, _mm256_max_epi32, SCALAR_MAX)
+VECTOR_KERNEL(__min_int_avx2, "avx2", int, __m256i, 8, LOADU_SI256,
+	      STOREU_SI256, _mm256_min_epi32, SCALAR_MIN)
+VECTOR_KERNEL(__prod_int_avx2, "avx2", int, __m256i, 8, LOADU_SI256,
+	      STOREU_SI256, _mm256_mullo_epi32, SCALAR_PROD)
+VECTOR_KERNEL(__sum_double_avx2, "avx2", double, __m256d, 4, LOADU_PD256,
+	      STOREU_PD256, _mm256_add_pd, SCALAR_SUM)
+VECTOR_KERNEL(__max_double_avx2, "avx2", double, __m256d, 4, LOADU_PD256,
+	      STOREU_PD256, _mm256_max_pd, SCALAR_MAX)
+VECTOR_KERNEL(__min_double_avx2, "avx2", double, __m256d, 4, LOADU_PD256,
+	      STOREU_PD256, _mm256_min_pd, SCALAR_MIN)
+VECTOR_KERNEL(__prod_double_avx2, "avx2", double, __m256d, 4, LOADU_PD256,
+	      STOREU_PD256, _mm256_mul_pd, SCALAR_PROD)
+#endif
+
+/*Kernel sets indexed by MPI_Op*/
+static const op_kernel_t scalar_int_ops[MPI_OP_COUNT] = {
+    __sum_int, __max_int, __min_int, __prod_int
+};
+static const op_kernel_t scalar_double_ops[MPI_OP_COUNT] = {
+    __sum_double, __max_double, __min_double, __prod_double
+};
+
+#ifdef OP_X86
+static const op_kernel_t sse_int_ops[MPI_OP_COUNT] = {
+    __sum_int_sse, __max_int_sse, __min_int_sse, __prod_int_sse
+};
+static const op_kernel_t sse_double_ops[MPI_OP_COUNT] = {
+    __sum_double_sse, __max_double_sse, __min_double_sse,
+    __prod_double_sse
+};
+static const op_kernel_t avx2_int_ops[MPI_OP_COUNT] = {
+    __sum_int_avx2, __max_int_avx2, __min_int_avx2, __prod_int_avx2
+};
+static const op_kernel_t avx2_double_ops[MPI_OP_COUNT] = {
+    __sum_double_avx2, __max_double_avx2, __min_double_avx2,
+    __prod_double_avx2
+};
+#endif
+
+/*Instruction set picked by op_init*/
+static const char *selected_isa = "scalar";
+
+void op_init(void)
+{
+    const op_kernel_t *int_ops = scalar_int_ops;
+    const op_kernel_t *double_ops = scalar_double_ops;
+    char *limit = getenv(OP_ISA_ENV);
+
+    selected_isa = "scalar";
+#ifdef OP_X86
+    __builtin_cpu_init();
+    if (!limit || strcmp(limit, "scalar") != 0) {
+	if (__builtin_cpu_supports("avx2")
+	    && !(limit && strcmp(limit, "sse") == 0)) {
+	    int_ops = avx2_int_ops;
+	    double_ops = avx2_double_ops;
+	    selected_isa = "avx2";
+	} else if (__builtin_cpu_supports("sse4.1")) {
+	    int_ops = sse_int_ops;
+	    double_ops = sse_double_ops;
+	    selected_isa = "sse";
+	}
+    }
+#else
+    (void) limit;
+#endif
+    dprintf("reduction kernels:%s\n", selected_isa);
+
+    //characters are not reduced
+    memcpy(datatype_mappings[MPI_INT].ops, int_ops,
+	   sizeof(op_kernel_t) * MPI_OP_COUNT);
+    memcpy(datatype_mappings[MPI_DOUBLE].ops, double_ops,
+	   sizeof(op_kernel_t) * MPI_OP_COUNT);
+}
@@ -0,0 +1,36 @@
+/**
+ * This header defines datatype descriptions and reduction kernels.
+ *
+ * Every datatype is described by its size and one kernel per reduction
+ * operation. Kernels are picked when the library is initialized, using the
+ * widest vector instructions the processor supports.
+ */
+#ifndef __MY_OP_H
+#define __MY_OP_H
+
+#include "mympi.h"
+
+/*Combines count elements of in into inout element by element*/
+typedef void (*op_kernel_t) (void * /*inout */ , const void * /*in */ ,
+			     unsigned int /*count */ );
+
+/*Datatype description*/
+struct datatype_mapping {
+    int size;			/*size of one element in bytes */
+    op_kernel_t ops[MPI_OP_COUNT];	/*reduction kernels, NULL if the
+					   operation is not defined */
+};
+
+/*Datatype descriptions indexed by MPI_Datatype, defined in mympi.c*/
+extern struct datatype_mapping datatype_mappings[];
+
+/*Environment variable which limits kernels to "scalar" or "sse"*/
+#define OP_ISA_ENV           "MYMPI_SIMD"
+
+/*
+ * This function fills reduction kernels of datatype descriptions for the
+ * processor the library runs on.
+ */
+void op_init(void);
+
+#endif
@@ -0,0 +1,1796 @@
+/**
+ * Implementation of the progress engine.
+ *
+ * Connections are non-blocking. Sends are queued per connection and
+ * written with vectored writes straight from the user buffer; whatever the
+ * socket does not take is written when epoll reports the connection
+ * writable again. Receives run a two state machine per connection: the
+ * fixed size header is collected first, then the payload is read straight
+ * into the buffer of the matching posted receive, or into a pooled message
+ * kept in the unexpected message queue when nobody has asked for it yet.
+ * TCP connections read through a receive buffer, so one read takes in as
+ * many small messages as the socket holds and the state machine parses
+ * them from memory; payloads too long to gain from it bypass the buffer.
+ * Symmetrically, with MYMPI_COALESCE_SIZE set small eager sends to a TCP
+ * peer are copied into a batch which goes out in one write once it is
+ * full, the caller blocks or MYMPI_COALESCE_DELAY microseconds passed.
+ * Bytes travel through the transport of the connection; for shared memory
+ * channels the descriptor only carries doorbells, so those channels are
+ * swept on every poll and armed before sleeping. With MYMPI_PROGRESS set
+ * to "spin" a caller which has to wait keeps polling for MYMPI_SPIN_US
+ * microseconds before it sleeps, which saves the wakeup on messages
+ * arriving shortly at the cost of a busy core.
+ *
+ * Messages above the eager limit use rendezvous instead: only MSG_RTS goes
+ * out, the receiver answers with MSG_CTS once a receive matches it and the
+ * payload follows as MSG_RDATA straight into the user buffer. This keeps
+ * large unexpected messages out of the pool and avoids copying them.
+ * With MYMPI_STREAMS above one, payloads larger than a chunk are striped
+ * over that many extra TCP streams as MSG_CHUNK messages instead; a
+ * stream is written and read by its own small state machine which only
+ * knows chunks.
+ */
+#include "myprogress.h"
+#include "mytransport.h"
+#include "myshm.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
+
+/*Define boolean values*/
+#define FALSE              0
+#define TRUE               1
+
+/*Maximum events handled per wait*/
+#define MAX_EVENTS         16
+
+/*Size of scratch buffer used to discard truncated payload*/
+#define DRAIN_BUFFER_SIZE  4096
+
+/*Messages larger than this many bytes are sent with rendezvous, can be
+ *overridden with environment variable MYMPI_EAGER_LIMIT*/
+#define DEFAULT_EAGER_LIMIT 65536
+#define EAGER_LIMIT_ENV    "MYMPI_EAGER_LIMIT"
+
+/*Payloads of large messages spanning more than one chunk are striped
+ *over this many extra streams to a TCP peer, both can be overridden with
+ *environment variables MYMPI_STREAMS and MYMPI_STRIPE_CHUNK*/
+#define DEFAULT_STREAMS    1
+#define MAX_STREAMS        16
+#define STREAMS_ENV        "MYMPI_STREAMS"
+#define DEFAULT_STRIPE_CHUNK 262144
+#define STRIPE_CHUNK_ENV   "MYMPI_STRIPE_CHUNK"
+
+/*Event identifier of an extra stream carries its number and direction
+ *next to the rank of the peer*/
+#define STRIPE_EVENT       0x80000000
+#define STRIPE_RX          0x40000000
+#define STRIPE_SHIFT       24
+#define STRIPE_RANK_MASK   0x00ffffff
+#define STRIPE_ID(rank, stripe, rx) \
+    (STRIPE_EVENT | ((rx) ? STRIPE_RX : 0) | ((stripe) << STRIPE_SHIFT) \
+     | (rank))
+
+/*Eager sends of up to MYMPI_COALESCE_SIZE bytes to a TCP peer are
+ *coalesced into batches of BATCH_BUFFER_SIZE bytes, which wait at most
+ *MYMPI_COALESCE_DELAY microseconds for more. Zero size, the default,
+ *turns coalescing off*/
+#define COALESCE_SIZE_ENV  "MYMPI_COALESCE_SIZE"
+#define COALESCE_DELAY_ENV "MYMPI_COALESCE_DELAY"
+#define DEFAULT_COALESCE_DELAY 100
+#define BATCH_BUFFER_SIZE  8192
+
+/*Progress mode, polling time before sleeping in spin mode and
+ *SO_BUSY_POLL of TCP sockets in microseconds*/
+#define PROGRESS_MODE_ENV  "MYMPI_PROGRESS"
+#define SPIN_TIME_ENV      "MYMPI_SPIN_US"
+#define DEFAULT_SPIN_TIME  1000
+#define BUSY_POLL_ENV      "MYMPI_BUSY_POLL"
+
+/*Size of the receive buffer of a TCP connection, reads of at least half
+ *of it go straight to their destination*/
+#define RECV_BUFFER_SIZE   65536
+
+/*Receive states of a connection*/
+#define RECV_HDR           0	/*reading message header */
+#define RECV_PAYLOAD       1	/*reading message payload */
+
+/*Extra stream of a connection, which only carries MSG_CHUNK messages*/
+struct stripe {
+    int fd;			/*stream descriptor or 0 */
+
+    /*send side of streams opened by this processor */
+    MPI_Request send_head;	/*queued chunks, head is being written */
+    MPI_Request send_tail;
+    int want_write;		/*writable events are watched */
+
+    /*receive side of streams opened by the peer */
+    msg_t hdr;			/*header of chunk being received */
+    unsigned int hdr_bytes;	/*header bytes received so far */
+    char *dst;			/*where next payload bytes go */
+    unsigned int dst_left;	/*payload bytes left for dst */
+    MPI_Request recv_req;	/*receive the chunk belongs to or NULL */
+};
+
+/*Progress engine state of a connection*/
+struct connection {
+    /*send side */
+    MPI_Request send_head;	/*queued sends, head is being written */
+    MPI_Request send_tail;
+    int want_write;		/*writable events are watched */
+    MPI_Request rndv_sends;	/*large sends waiting for MSG_CTS */
+    unsigned int next_rndv_id;	/*id of next large send */
+    char *batch;		/*coalesced messages not queued yet or NULL */
+    unsigned int batch_len;	/*bytes in batch */
+    uint64_t batch_start;	/*microsecond batch was opened */
+
+    /*receive side */
+    int recv_state;		/*RECV_HDR or RECV_PAYLOAD */
+    msg_t hdr;			/*header of message being received */
+    unsigned int hdr_bytes;	/*header bytes received so far */
+    char *dst;			/*where next payload bytes go */
+    unsigned int dst_left;	/*payload bytes left for dst */
+    unsigned int discard_left;	/*truncated payload bytes left */
+    MPI_Request recv_req;	/*matched receive or NULL */
+    msg_t *unexpected;		/*unexpected message or NULL */
+    MPI_Request rndv_recvs;	/*matched receives waiting for MSG_RDATA */
+    char *rbuf;			/*bytes read ahead, NULL reads unbuffered */
+    unsigned int rbuf_start;	/*first byte not parsed yet */
+    unsigned int rbuf_end;	/*end of bytes read */
+
+    /*extra streams, allocated on first use */
+    struct stripe *tx_stripes;	/*nr_streams streams to peer */
+    int no_stripes;		/*opening them failed, do not retry */
+    struct stripe *rx_stripes;	/*MAX_STREAMS streams from peer */
+};
+
+/*Connection state indexed by rank*/
+static struct connection *connections = NULL;
+
+/*Ranks connected through shared memory*/
+static int *shm_ranks = NULL;
+static int nr_shm_ranks = 0;
+
+/*Ranks with an open batch*/
+static int *batch_ranks = NULL;
+static int nr_batch_ranks = 0;
+
+/*Outstanding collective requests*/
+static MPI_Request active_colls = NULL;
+
+/*Recycled requests*/
+static MPI_Request free_requests = NULL;
+
+/*Largest message sent eagerly*/
+static unsigned int eager_limit = DEFAULT_EAGER_LIMIT;
+
+/*Extra streams per peer and size of the chunks striped over them*/
+static int nr_streams = DEFAULT_STREAMS;
+static unsigned int stripe_chunk = DEFAULT_STRIPE_CHUNK;
+
+/*Microseconds spent polling before sleeping and SO_BUSY_POLL of sockets*/
+static unsigned int spin_time = 0;
+static int busy_poll = 0;
+
+/*Largest payload coalesced and how long a batch waits*/
+static unsigned int coalesce_size = 0;
+static unsigned int coalesce_delay = DEFAULT_COALESCE_DELAY;
+
+/*
+ * Hands out a cleared request of kind.
+ */
+static MPI_Request __alloc_request(int kind)
+{
+    MPI_Request req = free_requests;
+
+    if (req) {
+	free_requests = req->next;
+    } else {
+	req = (MPI_Request) malloc(sizeof(struct _MPI_Request));
+	if (!req) {
+	    return NULL;
+	}
+    }
+    memset(req, 0, sizeof(struct _MPI_Request));
+    req->kind = kind;
+    return req;
+}
+
+void progress_free_request(MPI_Request req)
+{
+    if (req) {
+	req->next = free_requests;
+	free_requests = req;
+    }
+}
+
+int progress_init(void)
+{
+    char *limit = getenv(EAGER_LIMIT_ENV);
+
+    if (limit && *limit) {
+	eager_limit = (unsigned int) strtoul(limit, NULL, 10);
+	dprintf("eager limit:%u\n", eager_limit);
+    }
+    limit = getenv(STREAMS_ENV);
+    if (limit && *limit) {
+	nr_streams = atoi(limit);
+	nr_streams = nr_streams < 1 ? 1 :
+	    nr_streams > MAX_STREAMS ? MAX_STREAMS : nr_streams;
+	dprintf("streams:%d\n", nr_streams);
+    }
+    limit = getenv(STRIPE_CHUNK_ENV);
+    if (limit && *limit) {
+	stripe_chunk = (unsigned int) strtoul(limit, NULL, 10);
+	stripe_chunk = stripe_chunk ? stripe_chunk : DEFAULT_STRIPE_CHUNK;
+	dprintf("stripe chunk:%u\n", stripe_chunk);
+    }
+    limit = getenv(PROGRESS_MODE_ENV);
+    if (limit && strcmp(limit, "spin") == 0) {
+	spin_time = DEFAULT_SPIN_TIME;
+	limit = getenv(SPIN_TIME_ENV);
+	if (limit && *limit) {
+	    spin_time = (unsigned int) strtoul(limit, NULL, 10);
+	}
+	dprintf("spin progress:%u us\n", spin_time);
+    }
+    limit = getenv(BUSY_POLL_ENV);
+    if (limit && *limit) {
+	busy_poll = atoi(limit);
+	dprintf("busy poll:%d us\n", busy_poll);
+    }
+    limit = getenv(COALESCE_SIZE_ENV);
+    if (limit && *limit) {
+	coalesce_size = (unsigned int) strtoul(limit, NULL, 10);
+	if (coalesce_size > BATCH_BUFFER_SIZE - MIN_MSG_LENGTH) {
+	    coalesce_size = BATCH_BUFFER_SIZE - MIN_MSG_LENGTH;
+	}
+	dprintf("coalesce size:%u\n", coalesce_size);
+    }
+    limit = getenv(COALESCE_DELAY_ENV);
+    if (limit && *limit) {
+	coalesce_delay = (unsigned int) strtoul(limit, NULL, 10);
+	dprintf("coalesce delay:%u\n", coalesce_delay);
+    }
+
+    connections = (struct connection *)
+	malloc(sizeof(struct connection) * commtab->size);
+    if (!connections) {
+	dprintf("Failed to allocate connection state\n");
+	return MPI_ERR_OTHER;
+    }
+    memset(connections, 0, sizeof(struct connection) * commtab->size);
+
+    shm_ranks = (int *) malloc(sizeof(int) * commtab->size);
+    if (!shm_ranks) {
+	dprintf("Failed to allocate connection state\n");
+	free(connections);
+	connections = NULL;
+	return MPI_ERR_OTHER;
+    }
+    nr_shm_ranks = 0;
+
+    batch_ranks = (int *) malloc(sizeof(int) * commtab->size);
+    if (!batch_ranks) {
+	dprintf("Failed to allocate connection state\n");
+	free(shm_ranks);
+	shm_ranks = NULL;
+	free(connections);
+	connections = NULL;
+	return MPI_ERR_OTHER;
+    }
+    nr_batch_ranks = 0;
+    return MPI_SUCCESS;
+}
+
+void progress_finalize(void)
+{
+    MPI_Request req;
+
+    free(connections);
+    connections = NULL;
+    free(shm_ranks);
+    shm_ranks = NULL;
+    nr_shm_ranks = 0;
+    free(batch_ranks);
+    batch_ranks = NULL;
+    nr_batch_ranks = 0;
+    while ((req = free_requests) != NULL) {
+	free_requests = req->next;
+	free(req);
+    }
+}
+
+int progress_watch_listener(int fd)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = LISTENER_ID;
+    if (epoll_ctl(commtab->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+	dprintf("Failed to watch listening server:%d\n", fd);
+	return MPI_ERR_OTHER;
+    }
+    return MPI_SUCCESS;
+}
+
+/*
+ * Makes a descriptor non-blocking and sets the options every socket gets.
+ * Messages are written whole, so Nagle would only hold back their tails,
+ * protocol messages and doorbells until the previous ones are acknowledged.
+ */
+static int __tune_socket(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    int nodelay = 1;
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+	dprintf("Failed to make descriptor:%d non-blocking\n", fd);
+	return MPI_ERR_OTHER;
+    }
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+		   sizeof(nodelay)) < 0) {
+	dprintf("Failed to set TCP_NODELAY of descriptor:%d\n", fd);
+    }
+#ifdef SO_BUSY_POLL
+    if (busy_poll > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll,
+				    sizeof(busy_poll)) < 0) {
+	dprintf("Failed to set SO_BUSY_POLL of descriptor:%d\n", fd);
+    }
+#endif
+    return MPI_SUCCESS;
+}
+
+int progress_add_connection(int rank, int fd)
+{
+    struct epoll_event event;
+
+    if (__tune_socket(fd) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = rank;
+    if (epoll_ctl(commtab->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+	dprintf("Failed to watch descriptor:%d\n", fd);
+	return MPI_ERR_OTHER;
+    }
+
+    memset(&connections[rank], 0, sizeof(struct connection));
+    commtab->ctable[rank].fd = fd;
+    if (commtab->ctable[rank].shm) {
+	commtab->ctable[rank].transport = &shm_transport;
+	shm_ranks[nr_shm_ranks++] = rank;
+    } else {
+	commtab->ctable[rank].transport = &tcp_transport;
+	//shared memory ring needs no buffer of its own
+	connections[rank].rbuf = (char *) malloc(RECV_BUFFER_SIZE);
+	if (!connections[rank].rbuf) {
+	    dprintf("Reading rank:%d unbuffered\n", rank);
+	}
+    }
+    dprintf("Connection to rank:%d over %s\n", rank,
+	    commtab->ctable[rank].transport->name);
+    return MPI_SUCCESS;
+}
+
+/*
+ * Turns watching of writable events on a connection on or off.
+ */
+static void __want_write(int rank, int enable)
+{
+    struct connection *conn = &connections[rank];
+    struct epoll_event event;
+
+    if (conn->want_write == enable) {
+	return;
+    }
+    if (commtab->ctable[rank].shm) {
+	//shared memory channel is armed before sleeping instead
+	conn->want_write = enable;
+	return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.u32 = rank;
+    epoll_ctl(commtab->epfd, EPOLL_CTL_MOD, commtab->ctable[rank].fd,
+	      &event);
+    conn->want_write = enable;
+}
+
+/*
+ * Tunes an extra stream and watches it, for readable events
+ * if the peer opened it and for errors only otherwise.
+ */
+static int __watch_stripe(int rank, int stripe, int rx, int fd)
+{
+    struct epoll_event event;
+
+    if (__tune_socket(fd) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = rx ? EPOLLIN : 0;
+    event.data.u32 = STRIPE_ID(rank, stripe, rx);
+    if (epoll_ctl(commtab->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+	dprintf("Failed to watch descriptor:%d\n", fd);
+	return MPI_ERR_OTHER;
+    }
+    return MPI_SUCCESS;
+}
+
+/*
+ * Chunk is written or dropped, completes its send once it was the last.
+ */
+static void __finish_chunk(MPI_Request chunk, int error)
+{
+    MPI_Request req = chunk->parent;
+
+    if (error != MPI_SUCCESS) {
+	req->error = error;
+    }
+    if (--req->chunks_left == 0) {
+	req->complete = TRUE;
+    }
+    progress_free_request(chunk);
+}
+
+/*
+ * Closes extra streams of a connection, chunks not written yet fail their
+ * sends.
+ */
+static void __close_stripes(int rank)
+{
+    struct connection *conn = &connections[rank];
+    struct stripe *stripe;
+    MPI_Request chunk;
+    int i;
+
+    for (i = 0; conn->tx_stripes && i < nr_streams; i++) {
+	stripe = &conn->tx_stripes[i];
+	while ((chunk = stripe->send_head) != NULL) {
+	    stripe->send_head = chunk->next;
+	    __finish_chunk(chunk, MPI_ERR_OTHER);
+	}
+	if (stripe->fd) {
+	    epoll_ctl(commtab->epfd, EPOLL_CTL_DEL, stripe->fd, NULL);
+	    close(stripe->fd);
+	}
+    }
+    for (i = 0; conn->rx_stripes && i < MAX_STREAMS; i++) {
+	stripe = &conn->rx_stripes[i];
+	if (stripe->fd) {
+	    epoll_ctl(commtab->epfd, EPOLL_CTL_DEL, stripe->fd, NULL);
+	    close(stripe->fd);
+	}
+    }
+    free(conn->tx_stripes);
+    free(conn->rx_stripes);
+    conn->tx_stripes = NULL;
+    conn->rx_stripes = NULL;
+}
+
+int progress_add_stripe(int rank, int stripe, int fd)
+{
+    struct connection *conn = &connections[rank];
+
+    if (stripe < 0 || stripe >= MAX_STREAMS) {
+	dprintf("Invalid stream:%d from rank:%d\n", stripe, rank);
+	return MPI_ERR_OTHER;
+    }
+    if (!conn->rx_stripes) {
+	conn->rx_stripes = (struct stripe *)
+	    calloc(MAX_STREAMS, sizeof(struct stripe));
+	if (!conn->rx_stripes) {
+	    dprintf("Failed to allocate streams of rank:%d\n", rank);
+	    return MPI_ERR_OTHER;
+	}
+    }
+    if (conn->rx_stripes[stripe].fd) {
+	dprintf("Duplicate stream:%d from rank:%d\n", stripe, rank);
+	return MPI_ERR_OTHER;
+    }
+    if (__watch_stripe(rank, stripe, TRUE, fd) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    conn->rx_stripes[stripe].fd = fd;
+    dprintf("Accepted stream:%d from rank:%d fd:%d\n", stripe, rank, fd);
+    return MPI_SUCCESS;
+}
+
+/*
+ * Drops open batch of a connection.
+ */
+static void __forget_batch(int rank)
+{
+    struct connection *conn = &connections[rank];
+    int i;
+
+    for (i = 0; i < nr_batch_ranks; i++) {
+	if (batch_ranks[i] == rank) {
+	    batch_ranks[i] = batch_ranks[--nr_batch_ranks];
+	    break;
+	}
+    }
+    free(conn->batch);
+    conn->batch = NULL;
+    conn->batch_len = 0;
+}
+
+void progress_close_connection(int rank)
+{
+    struct connection *conn = &connections[rank];
+    struct context_table *entry = &commtab->ctable[rank];
+    struct posted_recv *posted;
+    MPI_Request req;
+    int i;
+
+    __close_stripes(rank);
+    if (entry->fd) {
+	epoll_ctl(commtab->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+	close(entry->fd);
+	entry->fd = 0;
+    }
+    if (entry->transport) {
+	entry->transport->close(entry);
+	entry->transport = NULL;
+    }
+    for (i = 0; i < nr_shm_ranks; i++) {
+	if (shm_ranks[i] == rank) {
+	    shm_ranks[i] = shm_ranks[--nr_shm_ranks];
+	    break;
+	}
+    }
+    //drop messages which never made it
+    if (conn->batch) {
+	__forget_batch(rank);
+    }
+    while ((req = conn->send_head) != NULL) {
+	conn->send_head = req->next;
+	req->next = NULL;
+	if (req->kind == REQ_CTRL) {
+	    free(req->buff);
+	    progress_free_request(req);
+	    continue;
+	}
+	req->error = MPI_ERR_OTHER;
+	req->complete = TRUE;
+    }
+    //and rendezvous which never finished
+    while ((req = conn->rndv_sends) != NULL) {
+	conn->rndv_sends = req->next;
+	req->next = NULL;
+	req->error = MPI_ERR_OTHER;
+	req->complete = TRUE;
+    }
+    while ((req = conn->rndv_recvs) != NULL) {
+	conn->rndv_recvs = req->next;
+	req->next = NULL;
+	req->error = MPI_ERR_OTHER;
+	req->complete = TRUE;
+    }
+    //fail partially received message
+    if (conn->recv_req) {
+	conn->recv_req->error = MPI_ERR_OTHER;
+	conn->recv_req->complete = TRUE;
+    }
+    //nothing will arrive for receives waiting on this peer only
+    while ((posted = match_take_posted_from(commtab->match, rank)) != NULL) {
+	req = (MPI_Request) posted->req;
+	req->error = MPI_ERR_OTHER;
+	req->complete = TRUE;
+    }
+    release_msg(conn->unexpected);
+    free(conn->rbuf);
+
+    memset(conn, 0, sizeof(struct connection));
+}
+
+/*
+ * Writes queued sends of a connection till the socket is full.
+ */
+static int __progress_send(int rank)
+{
+    struct connection *conn = &connections[rank];
+    struct context_table *entry = &commtab->ctable[rank];
+    MPI_Request req;
+    int ret;
+
+    while ((req = conn->send_head) != NULL) {
+	ret = entry->transport->write_iov(entry, &req->iov_next,
+					  &req->iovcnt);
+	if (ret == MSG_AGAIN) {
+	    //wait till socket drains
+	    __want_write(rank, TRUE);
+	    return MPI_SUCCESS;
+	} else if (ret != MSG_SUCCESS) {
+	    dprintf("Failed to send message to rank:%d\n", rank);
+	    progress_close_connection(rank);
+	    return MPI_ERR_OTHER;
+	}
+	//message is on its way
+	conn->send_head = req->next;
+	if (!conn->send_head) {
+	    conn->send_tail = NULL;
+	}
+	req->next = NULL;
+	if (req->kind == REQ_CTRL) {
+	    //batch of coalesced messages owns its buffer
+	    free(req->buff);
+	    progress_free_request(req);
+	} else if (req->rndv_state == RNDV_RTS) {
+	    //payload waits till receiver is ready for it
+	    req->rndv_state = RNDV_WAIT_CTS;
+	    req->next = conn->rndv_sends;
+	    conn->rndv_sends = req;
+	} else {
+	    req->complete = TRUE;
+	}
+    }
+    __want_write(rank, FALSE);
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Appends request to send queue of a connection and starts writing it if
+ * nothing else is queued.
+ * Return value
+ *     MPI_SUCCESS or MPI_ERR_OTHER if an open batch, which has to go out
+ *     first, cannot be flushed; request is not queued then
+ */
+static int __flush_batch(int peer);
+
+static int __queue_send(int peer, MPI_Request req)
+{
+    struct connection *conn = &connections[peer];
+
+    //coalesced messages were sent first
+    if (conn->batch && __flush_batch(peer) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+
+    //messages to a peer leave in the order they were sent
+    if (conn->send_tail) {
+	conn->send_tail->next = req;
+    } else {
+	conn->send_head = req;
+    }
+    conn->send_tail = req;
+
+    //try to push it out right away
+    if (conn->send_head == req) {
+	__progress_send(peer);
+    }
+    return MPI_SUCCESS;
+}
+
+/*
+ * Returns monotonic time in microseconds.
+ */
+static uint64_t __now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Queues open batch of a connection as one control message, which owns
+ * the batch buffer from now on.
+ * Return value
+ *     MPI_SUCCESS or MPI_ERR_OTHER with batch still open
+ */
+static int __flush_batch(int peer)
+{
+    struct connection *conn = &connections[peer];
+    MPI_Request req = __alloc_request(REQ_CTRL);
+
+    if (!req) {
+	dprintf("Failed to flush batch to rank:%d\n", peer);
+	return MPI_ERR_OTHER;
+    }
+    req->peer = peer;
+    req->buff = conn->batch;
+    req->iov[0].iov_base = conn->batch;
+    req->iov[0].iov_len = conn->batch_len;
+    req->iov_next = req->iov;
+    req->iovcnt = 1;
+    conn->batch = NULL;
+    __forget_batch(peer);
+    return __queue_send(peer, req);
+}
+
+/*
+ * Flushes open batches, all of them or those which waited long enough.
+ */
+static void __flush_batches(int all)
+{
+    uint64_t now = __now_us();
+    int rank;
+    int i;
+
+    //flushing reorders the array, walk it backwards
+    for (i = nr_batch_ranks - 1; i >= 0; i--) {
+	rank = batch_ranks[i];
+	//batch failing to flush stays open for the next try
+	if (all || now - connections[rank].batch_start >= coalesce_delay) {
+	    __flush_batch(rank);
+	}
+    }
+}
+
+/*
+ * Appends a small message to the batch of a connection, opening one if
+ * needed.
+ * Return value
+ *     MPI_SUCCESS if message is coalesced or else MPI_ERR_OTHER
+ */
+static int __coalesce(int peer, msg_t * hdr, void *buff,
+		      unsigned int length)
+{
+    struct connection *conn = &connections[peer];
+    unsigned int size = MIN_MSG_LENGTH + length;
+
+    if (conn->batch && conn->batch_len + size > BATCH_BUFFER_SIZE
+	&& __flush_batch(peer) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    if (!conn->batch) {
+	conn->batch = (char *) malloc(BATCH_BUFFER_SIZE);
+	if (!conn->batch) {
+	    return MPI_ERR_OTHER;
+	}
+	conn->batch_len = 0;
+	conn->batch_start = __now_us();
+	batch_ranks[nr_batch_ranks++] = peer;
+    }
+    //messages keep their headers, receiver parses batch like a stream
+    memcpy(conn->batch + conn->batch_len, hdr, MIN_MSG_LENGTH);
+    memcpy(conn->batch + conn->batch_len + MIN_MSG_LENGTH, buff, length);
+    conn->batch_len += size;
+
+    if (__now_us() - conn->batch_start >= coalesce_delay) {
+	__flush_batch(peer);
+    }
+    return MPI_SUCCESS;
+}
+
+/*
+ * Delivers a message this processor sends to itself through the matching
+ * queues, into a posted receive or else a copy kept as unexpected. Send is
+ * complete right away whatever its size.
+ */
+static int __send_self(MPI_Request req, void *buff, unsigned int length,
+		       MPI_Datatype datatype, int tag)
+{
+    int self = commtab->rank;
+    struct posted_recv *posted;
+    MPI_Request recv;
+    msg_t *pMsg;
+
+    posted = match_take_posted(commtab->match, self, tag);
+    if (posted) {
+	recv = (MPI_Request) posted->req;
+	recv->status.MPI_SOURCE = self;
+	recv->status.MPI_TAG = tag;
+	recv->status.length = length < recv->capacity ? length :
+	    recv->capacity;
+	memcpy(recv->buff, buff, recv->status.length);
+	if (length > recv->capacity) {
+	    dprintf("message of %u bytes truncated to %u bytes\n", length,
+		    recv->capacity);
+	    recv->error = MPI_ERR_TRUNCATE;
+	}
+	recv->complete = TRUE;
+    } else {
+	if (acquire_msg(&pMsg, length) != MSG_SUCCESS) {
+	    dprintf("Failed to allocate message to self\n");
+	    return MPI_ERR_OTHER;
+	}
+	build_data_hdr(pMsg, datatype, tag, length);
+	memcpy(pMsg->payload, buff, length);
+	if (match_add_unexpected(commtab->match, self, pMsg) != MSG_SUCCESS) {
+	    release_msg(pMsg);
+	    return MPI_ERR_OTHER;
+	}
+    }
+    req->complete = TRUE;
+    return MPI_SUCCESS;
+}
+
+int progress_isend(void *buff, unsigned int length, MPI_Datatype datatype,
+		   int peer, int tag, MPI_Request * request)
+{
+    struct connection *conn = &connections[peer];
+    MPI_Request req = __alloc_request(REQ_SEND);
+
+    if (!req) {
+	return MPI_ERR_OTHER;
+    }
+    req->peer = peer;
+
+    if (peer == commtab->rank) {
+	if (__send_self(req, buff, length, datatype, tag) != MPI_SUCCESS) {
+	    progress_free_request(req);
+	    return MPI_ERR_OTHER;
+	}
+	*request = req;
+	return MPI_SUCCESS;
+    }
+
+    //header is sent from the request and payload from user buffer
+    req->iov[0].iov_base = &req->hdr;
+    req->iov[0].iov_len = MIN_MSG_LENGTH;
+    req->iov[1].iov_base = buff;
+    req->iov[1].iov_len = length;
+    req->iov_next = req->iov;
+    if (length > eager_limit) {
+	//announce it, payload is sent on MSG_CTS
+	req->rndv_state = RNDV_RTS;
+	req->rndv_id = conn->next_rndv_id++;
+	build_rndv_hdr(&req->hdr, MSG_RTS, tag, req->rndv_id, length, 0);
+	req->iovcnt = 1;
+    } else {
+	build_data_hdr(&req->hdr, datatype, tag, length);
+	req->iovcnt = 2;
+	//small message is copied into a batch and done with
+	if (length <= coalesce_size && !commtab->ctable[peer].shm
+	    && __coalesce(peer, &req->hdr, buff, length) == MPI_SUCCESS) {
+	    req->complete = TRUE;
+	    *request = req;
+	    return MPI_SUCCESS;
+	}
+    }
+    //never overtake a batch which is still open
+    if (__queue_send(peer, req) != MPI_SUCCESS) {
+	progress_free_request(req);
+	return MPI_ERR_OTHER;
+    }
+
+    *request = req;
+    return MPI_SUCCESS;
+}
+
+/*
+ * Queues a payload-less protocol message to a peer.
+ */
+static int __send_ctrl(int peer, unsigned int type, unsigned int id,
+		       unsigned int size)
+{
+    MPI_Request req = __alloc_request(REQ_CTRL);
+
+    if (!req) {
+	return MPI_ERR_OTHER;
+    }
+    req->peer = peer;
+    build_rndv_hdr(&req->hdr, type, 0, id, size, 0);
+    req->iov[0].iov_base = &req->hdr;
+    req->iov[0].iov_len = MIN_MSG_LENGTH;
+    req->iov_next = req->iov;
+    req->iovcnt = 1;
+    if (__queue_send(peer, req) != MPI_SUCCESS) {
+	progress_free_request(req);
+	return MPI_ERR_OTHER;
+    }
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Turns watching of writable events on an extra stream on or off.
+ */
+static void __stripe_want_write(int rank, int i, int enable)
+{
+    struct stripe *stripe = &connections[rank].tx_stripes[i];
+    struct epoll_event event;
+
+    if (stripe->want_write == enable) {
+	return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = enable ? EPOLLOUT : 0;
+    event.data.u32 = STRIPE_ID(rank, i, FALSE);
+    epoll_ctl(commtab->epfd, EPOLL_CTL_MOD, stripe->fd, &event);
+    stripe->want_write = enable;
+}
+
+/*
+ * Writes queued chunks of an extra stream till the socket is full.
+ */
+static int __progress_stripe_send(int rank, int i)
+{
+    struct stripe *stripe = &connections[rank].tx_stripes[i];
+    MPI_Request chunk;
+    int ret;
+
+    while ((chunk = stripe->send_head) != NULL) {
+	ret = write_iov(stripe->fd, &chunk->iov_next, &chunk->iovcnt);
+	if (ret == MSG_AGAIN) {
+	    __stripe_want_write(rank, i, TRUE);
+	    return MPI_SUCCESS;
+	} else if (ret != MSG_SUCCESS) {
+	    dprintf("Failed to send chunk to rank:%d stream:%d\n", rank, i);
+	    progress_close_connection(rank);
+	    return MPI_ERR_OTHER;
+	}
+	stripe->send_head = chunk->next;
+	if (!stripe->send_head) {
+	    stripe->send_tail = NULL;
+	}
+	__finish_chunk(chunk, MPI_SUCCESS);
+    }
+    __stripe_want_write(rank, i, FALSE);
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Appends chunk to send queue of an extra stream and starts writing it if
+ * nothing else is queued.
+ */
+static void __queue_chunk(int rank, int i, MPI_Request chunk)
+{
+    struct stripe *stripe = &connections[rank].tx_stripes[i];
+
+    if (stripe->send_tail) {
+	stripe->send_tail->next = chunk;
+    } else {
+	stripe->send_head = chunk;
+    }
+    stripe->send_tail = chunk;
+
+    if (stripe->send_head == chunk) {
+	__progress_stripe_send(rank, i);
+    }
+}
+
+/*
+ * Opens extra streams to a peer.
+ */
+static int __open_stripes(int rank)
+{
+    struct connection *conn = &connections[rank];
+    int fd;
+    int i;
+
+    conn->tx_stripes = (struct stripe *)
+	calloc(nr_streams, sizeof(struct stripe));
+    if (!conn->tx_stripes) {
+	conn->no_stripes = TRUE;
+	return MPI_ERR_OTHER;
+    }
+    for (i = 0; i < nr_streams; i++) {
+	if (__connect_stripe(rank, i, &fd) != MPI_SUCCESS) {
+	    break;
+	}
+	conn->tx_stripes[i].fd = fd;
+	if (__watch_stripe(rank, i, FALSE, fd) != MPI_SUCCESS) {
+	    break;
+	}
+    }
+    if (i < nr_streams) {
+	//peer drops the ones it got once they hang up
+	dprintf("Failed to open streams to rank:%d\n", rank);
+	for (i = 0; i < nr_streams; i++) {
+	    if (conn->tx_stripes[i].fd) {
+		epoll_ctl(commtab->epfd, EPOLL_CTL_DEL,
+			  conn->tx_stripes[i].fd, NULL);
+		close(conn->tx_stripes[i].fd);
+	    }
+	}
+	free(conn->tx_stripes);
+	conn->tx_stripes = NULL;
+	conn->no_stripes = TRUE;
+	return MPI_ERR_OTHER;
+    }
+    dprintf("Opened %d streams to rank:%d\n", nr_streams, rank);
+    return MPI_SUCCESS;
+}
+
+/*
+ * Stripes size bytes of payload of a large send over the extra streams
+ * of a peer. Message is cut into chunks first and only then queued, so it
+ * is left to the connection if anything fails.
+ * Return value
+ *     MPI_SUCCESS if payload is striped or else MPI_ERR_OTHER
+ */
+static int __stripe_send(int rank, MPI_Request req, unsigned int size)
+{
+    struct connection *conn = &connections[rank];
+    MPI_Request chunks = NULL;
+    MPI_Request *tail = &chunks;
+    MPI_Request chunk;
+    unsigned int offset;
+    unsigned int length;
+    int nr_chunks = 0;
+
+    if (nr_streams < 2 || size <= stripe_chunk || conn->no_stripes
+	|| commtab->ctable[rank].shm) {
+	return MPI_ERR_OTHER;
+    }
+    if (!conn->tx_stripes && __open_stripes(rank) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+
+    for (offset = 0; offset < size; offset += length) {
+	length = size - offset < stripe_chunk ? size - offset : stripe_chunk;
+	if (!(chunk = __alloc_request(REQ_CHUNK))) {
+	    while ((chunk = chunks) != NULL) {
+		chunks = chunk->next;
+		progress_free_request(chunk);
+	    }
+	    return MPI_ERR_OTHER;
+	}
+	chunk->peer = rank;
+	chunk->parent = req;
+	build_chunk_hdr(&chunk->hdr, req->rndv_id, offset, size, length);
+	chunk->iov[0].iov_base = &chunk->hdr;
+	chunk->iov[0].iov_len = MIN_MSG_LENGTH;
+	chunk->iov[1].iov_base = (char *) req->iov[1].iov_base + offset;
+	chunk->iov[1].iov_len = length;
+	chunk->iov_next = chunk->iov;
+	chunk->iovcnt = 2;
+	*tail = chunk;
+	tail = &chunk->next;
+	nr_chunks++;
+    }
+
+    //streams take chunks in turn
+    req->rndv_state = RNDV_DATA;
+    req->chunks_left = nr_chunks;
+    for (nr_chunks = 0; (chunk = chunks) != NULL; nr_chunks++) {
+	chunks = chunk->next;
+	chunk->next = NULL;
+	if (!conn->tx_stripes) {
+	    //writing an earlier chunk failed and closed the connection
+	    __finish_chunk(chunk, MPI_ERR_OTHER);
+	    continue;
+	}
+	__queue_chunk(rank, nr_chunks % nr_streams, chunk);
+    }
+    return MPI_SUCCESS;
+}
+
+/*
+ * Receiver is ready for a large message, send its payload.
+ */
+static int __handle_cts(int rank, msg_t * hdr)
+{
+    struct connection *conn = &connections[rank];
+    MPI_Request *link = &conn->rndv_sends;
+    MPI_Request req;
+
+    while ((req = *link) != NULL && req->rndv_id != hdr->rndv.id) {
+	link = &req->next;
+    }
+    if (!req || hdr->rndv.size > req->iov[1].iov_len) {
+	dprintf("Unexpected MSG_CTS:%u from rank:%d\n", hdr->rndv.id, rank);
+	return MPI_ERR_OTHER;
+    }
+    *link = req->next;
+    req->next = NULL;
+
+    //long payload goes over extra streams if there are any
+    if (__stripe_send(rank, req, hdr->rndv.size) == MPI_SUCCESS) {
+	return MPI_SUCCESS;
+    }
+    //only what receiver can take is sent
+    req->rndv_state = RNDV_DATA;
+    build_rndv_hdr(&req->hdr, MSG_RDATA, 0, req->rndv_id, hdr->rndv.size,
+		   hdr->rndv.size);
+    req->iov[0].iov_base = &req->hdr;
+    req->iov[0].iov_len = MIN_MSG_LENGTH;
+    req->iov[1].iov_len = hdr->rndv.size;
+    req->iov_next = req->iov;
+    req->iovcnt = 2;
+    if (__queue_send(rank, req) != MPI_SUCCESS) {
+	req->error = MPI_ERR_OTHER;
+	req->complete = TRUE;
+	return MPI_ERR_OTHER;
+    }
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Matches receive request with announced large message and tells sender to
+ * go ahead.
+ */
+static int __accept_rts(MPI_Request req, int source, msg_t * hdr)
+{
+    struct connection *conn = &connections[source];
+    unsigned int accepted =
+	hdr->rndv.size < req->capacity ? hdr->rndv.size : req->capacity;
+
+    req->status.MPI_SOURCE = source;
+    req->status.MPI_TAG = hdr->rndv.tag;
+    req->status.length = accepted;
+    if (accepted < hdr->rndv.size) {
+	dprintf("message of %u bytes truncated to %u bytes\n",
+		hdr->rndv.size, req->capacity);
+	req->error = MPI_ERR_TRUNCATE;
+    }
+    req->rndv_id = hdr->rndv.id;
+    req->rndv_left = accepted;
+    req->next = conn->rndv_recvs;
+    conn->rndv_recvs = req;
+
+    return __send_ctrl(source, MSG_CTS, hdr->rndv.id, accepted);
+}
+
+/*
+ * Completes receive request with a fully received message and releases
+ * the message.
+ */
+static void __complete_from_msg(MPI_Request req, int source, msg_t * pMsg)
+{
+    unsigned int received =
+	pMsg->length < req->capacity ? pMsg->length : req->capacity;
+
+    memcpy(req->buff, pMsg->payload, received);
+    req->status.MPI_SOURCE = source;
+    req->status.MPI_TAG = pMsg->data.tag;
+    req->status.length = received;
+    if (received < pMsg->length) {
+	dprintf("message of %u bytes truncated to %u bytes\n",
+		pMsg->length, req->capacity);
+	req->error = MPI_ERR_TRUNCATE;
+    }
+    req->complete = TRUE;
+
+    release_msg(pMsg);
+}
+
+int progress_irecv(void *buff, unsigned int capacity, int source, int tag,
+		   MPI_Request * request)
+{
+    MPI_Request req = __alloc_request(REQ_RECV);
+    msg_t *pMsg;
+    int msg_source;
+
+    if (!req) {
+	return MPI_ERR_OTHER;
+    }
+    req->buff = buff;
+    req->capacity = capacity;
+
+    //message may have arrived already
+    pMsg = match_take_unexpected(commtab->match, source, tag, &msg_source);
+    if (pMsg && (pMsg->type & MSG_RTS)) {
+	//or was announced only
+	if (__accept_rts(req, msg_source, pMsg) != MPI_SUCCESS) {
+	    req->error = MPI_ERR_OTHER;
+	    req->complete = TRUE;
+	}
+	release_msg(pMsg);
+    } else if (pMsg) {
+	__complete_from_msg(req, msg_source, pMsg);
+    } else {
+	req->posted.source = source;
+	req->posted.tag = tag;
+	req->posted.req = req;
+	match_post_recv(commtab->match, &req->posted);
+    }
+
+    *request = req;
+    return MPI_SUCCESS;
+}
+
+/*
+ * Header of a message is complete, decide where its payload goes.
+ */
+static int __start_payload(int rank)
+{
+    struct connection *conn = &connections[rank];
+    msg_t *hdr = &conn->hdr;
+    struct posted_recv *posted;
+    MPI_Request *link;
+    MPI_Request req;
+
+    if (hdr->type & MSG_CTS) {
+	return __handle_cts(rank, hdr);
+    } else if (hdr->type & MSG_RTS) {
+	posted = match_take_posted(commtab->match, rank, hdr->rndv.tag);
+	if (posted) {
+	    return __accept_rts((MPI_Request) posted->req, rank, hdr);
+	}
+	//remember the announcement till a receive asks for it
+	if (acquire_msg(&conn->unexpected, 0) != MSG_SUCCESS) {
+	    dprintf("Failed to allocate unexpected message\n");
+	    return MPI_ERR_OTHER;
+	}
+	memcpy(conn->unexpected, hdr, MIN_MSG_LENGTH);
+	if (match_add_unexpected(commtab->match, rank, conn->unexpected) !=
+	    MSG_SUCCESS) {
+	    release_msg(conn->unexpected);
+	    conn->unexpected = NULL;
+	    return MPI_ERR_OTHER;
+	}
+	conn->unexpected = NULL;
+	return MPI_SUCCESS;
+    } else if (hdr->type & MSG_RDATA) {
+	//payload of a matched large message
+	link = &conn->rndv_recvs;
+	while ((req = *link) != NULL && req->rndv_id != hdr->rndv.id) {
+	    link = &req->next;
+	}
+	if (!req || hdr->length > req->capacity) {
+	    dprintf("Unexpected MSG_RDATA:%u from rank:%d\n", hdr->rndv.id,
+		    rank);
+	    return MPI_ERR_OTHER;
+	}
+	*link = req->next;
+	req->next = NULL;
+	conn->recv_req = req;
+	conn->dst = req->buff;
+	conn->dst_left = hdr->length;
+	conn->discard_left = 0;
+	conn->recv_state = RECV_PAYLOAD;
+	return MPI_SUCCESS;
+    } else if (!(hdr->type & MSG_DATA)) {
+	dprintf("Expecting MSG_DATA message from rank:%d\n", rank);
+	return MPI_ERR_OTHER;
+    }
+
+    posted = match_take_posted(commtab->match, rank, hdr->data.tag);
+    if (posted) {
+	//payload goes straight into user buffer
+	req = (MPI_Request) posted->req;
+	conn->recv_req = req;
+	conn->dst = req->buff;
+	conn->dst_left =
+	    hdr->length < req->capacity ? hdr->length : req->capacity;
+	conn->discard_left = hdr->length - conn->dst_left;
+	req->status.MPI_SOURCE = rank;
+	req->status.MPI_TAG = hdr->data.tag;
+	req->status.length = conn->dst_left;
+	if (conn->discard_left) {
+	    dprintf("message of %u bytes truncated to %u bytes\n",
+		    hdr->length, req->capacity);
+	    req->error = MPI_ERR_TRUNCATE;
+	}
+    } else {
+	//nobody asked for it yet
+	if (acquire_msg(&conn->unexpected, hdr->length) != MSG_SUCCESS) {
+	    dprintf("Failed to allocate unexpected message\n");
+	    return MPI_ERR_OTHER;
+	}
+	memcpy(conn->unexpected, hdr, MIN_MSG_LENGTH);
+	conn->dst = conn->unexpected->payload;
+	conn->dst_left = hdr->length;
+	conn->discard_left = 0;
+    }
+    conn->recv_state = RECV_PAYLOAD;
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Whole message is received, hand it over.
+ */
+static int __finish_payload(int rank)
+{
+    struct connection *conn = &connections[rank];
+    struct posted_recv *posted;
+    msg_t *pMsg;
+
+    if (conn->recv_req) {
+	conn->recv_req->complete = TRUE;
+	conn->recv_req = NULL;
+    } else {
+	pMsg = conn->unexpected;
+	conn->unexpected = NULL;
+
+	//a receive may have been posted while the payload was arriving
+	posted = match_take_posted(commtab->match, rank, pMsg->data.tag);
+	if (posted) {
+	    __complete_from_msg((MPI_Request) posted->req, rank, pMsg);
+	} else if (match_add_unexpected(commtab->match, rank, pMsg) !=
+		   MSG_SUCCESS) {
+	    release_msg(pMsg);
+	    return MPI_ERR_OTHER;
+	}
+    }
+    conn->recv_state = RECV_HDR;
+    conn->hdr_bytes = 0;
+
+    return MPI_SUCCESS;
+}
+
+/*
+ * Reads at most n bytes of a connection which are available right now,
+ * taking them from the receive buffer first and refilling it with one
+ * read once it is empty.
+ * Return value
+ *     number of bytes read, MSG_AGAIN if nothing is available,
+ *     MSG_CONN_CLOSED or MSG_ERROR
+ */
+static int __read_conn(int rank, void *buffer, unsigned int n)
+{
+    struct connection *conn = &connections[rank];
+    struct context_table *entry = &commtab->ctable[rank];
+    unsigned int avail;
+    int nread;
+
+    if (!conn->rbuf) {
+	return entry->transport->read_avail(entry, buffer, n);
+    }
+    if (conn->rbuf_start == conn->rbuf_end) {
+	if (n >= RECV_BUFFER_SIZE / 2) {
+	    //copying it once more would not save a read
+	    return entry->transport->read_avail(entry, buffer, n);
+	}
+	nread = entry->transport->read_avail(entry, conn->rbuf,
+					     RECV_BUFFER_SIZE);
+	if (nread < 0) {
+	    return nread;
+	}
+	conn->rbuf_start = 0;
+	conn->rbuf_end = nread;
+    }
+    avail = conn->rbuf_end - conn->rbuf_start;
+    if (avail > n) {
+	avail = n;
+    }
+    memcpy(buffer, conn->rbuf + conn->rbuf_start, avail);
+    conn->rbuf_start += avail;
+    return avail;
+}
+
+/*
+ * Reads everything available on a connection.
+ */
+static int __progress_recv(int rank)
+{
+    struct connection *conn = &connections[rank];
+    struct context_table *entry = &commtab->ctable[rank];
+    char scratch[DRAIN_BUFFER_SIZE];
+    int nread;
+
+    while (TRUE) {
+	if (conn->recv_state == RECV_HDR) {
+	    nread = __read_conn(rank, (char *) &conn->hdr + conn->hdr_bytes,
+				MIN_MSG_LENGTH - conn->hdr_bytes);
+	    if (nread < 0) {
+		break;
+	    }
+	    conn->hdr_bytes += nread;
+	    if (conn->hdr_bytes < MIN_MSG_LENGTH) {
+		continue;
+	    }
+	    if (__start_payload(rank) != MPI_SUCCESS) {
+		progress_close_connection(rank);
+		return MPI_ERR_OTHER;
+	    }
+	    if (!entry->fd) {
+		//answering it failed and closed the connection
+		return MPI_ERR_OTHER;
+	    }
+	    if (conn->recv_state == RECV_HDR) {
+		//protocol message without payload was handled
+		conn->hdr_bytes = 0;
+		continue;
+	    }
+	} else if (conn->dst_left > 0) {
+	    nread = __read_conn(rank, conn->dst, conn->dst_left);
+	    if (nread < 0) {
+		break;
+	    }
+	    conn->dst += nread;
+	    conn->dst_left -= nread;
+	} else if (conn->discard_left > 0) {
+	    nread = __read_conn(rank, scratch,
+				conn->discard_left < DRAIN_BUFFER_SIZE ?
+				conn->discard_left : DRAIN_BUFFER_SIZE);
+	    if (nread < 0) {
+		break;
+	    }
+	    conn->discard_left -= nread;
+	}
+
+	if (conn->recv_state == RECV_PAYLOAD && conn->dst_left == 0
+	    && conn->discard_left == 0) {
+	    if (__finish_payload(rank) != MPI_SUCCESS) {
+		progress_close_connection(rank);
+		return MPI_ERR_OTHER;
+	    }
+	}
+    }
+
+    if (nread == MSG_AGAIN) {
+	return MPI_SUCCESS;
+    }
+    if (nread == MSG_CONN_CLOSED && conn->recv_state == RECV_HDR
+	&& conn->hdr_bytes == 0) {
+	//peer has finished, stop watching its connection
+	dprintf("Connection closed by rank:%d\n", rank);
+	progress_close_connection(rank);
+	return MPI_SUCCESS;
+    }
+    dprintf("Failed to receive message from rank:%d\n", rank);
+    progress_close_connection(rank);
+    return MPI_ERR_OTHER;
+}
+
+/*
+ * Header of a chunk is complete, find the receive it belongs to.
+ */
+static int __start_chunk(int rank, struct stripe *stripe)
+{
+    struct connection *conn = &connections[rank];
+    msg_t *hdr = &stripe->hdr;
+    MPI_Request req = conn->rndv_recvs;
+
+    if (!(hdr->type & MSG_CHUNK)) {
+	dprintf("Expecting MSG_CHUNK message from rank:%d\n", rank);
+	return MPI_ERR_OTHER;
+    }
+    while (req && req->rndv_id != hdr->chunk.id) {
+	req = req->next;
+    }
+    if (!req || hdr->chunk.size != req->status.length
+	|| hdr->chunk.offset > hdr->chunk.size
+	|| hdr->length > hdr->chunk.size - hdr->chunk.offset
+	|| hdr->length > req->rndv_left) {
+	dprintf("Unexpected MSG_CHUNK:%u from rank:%d\n", hdr->chunk.id,
+		rank);
+	return MPI_ERR_OTHER;
+    }
+    stripe->recv_req = req;
+    stripe->dst = (char *) req->buff + hdr->chunk.offset;
+    stripe->dst_left = hdr->length;
+    return MPI_SUCCESS;
+}
+
+/*
+ * Whole chunk is received, completes its receive once it was the last.
+ */
+static void __finish_chunk_recv(int rank, struct stripe *stripe)
+{
+    struct connection *conn = &connections[rank];
+    MPI_Request req = stripe->recv_req;
+    MPI_Request *link;
+
+    req->rndv_left -= stripe->hdr.length;
+    if (req->rndv_left == 0) {
+	link = &conn->rndv_recvs;
+	while (*link != req) {
+	    link = &(*link)->next;
+	}
+	*link = req->next;
+	req->next = NULL;
+	req->complete = TRUE;
+    }
+    stripe->recv_req = NULL;
+    stripe->hdr_bytes = 0;
+}
+
+/*
+ * Reads everything available on an extra stream opened by a peer.
+ */
+static int __progress_stripe_recv(int rank, int i)
+{
+    struct stripe *stripe = &connections[rank].rx_stripes[i];
+    int nread;
+
+    while (TRUE) {
+	if (!stripe->recv_req) {
+	    nread = read_avail(stripe->fd,
+			       (char *) &stripe->hdr + stripe->hdr_bytes,
+			       MIN_MSG_LENGTH - stripe->hdr_bytes);
+	    if (nread < 0) {
+		break;
+	    }
+	    stripe->hdr_bytes += nread;
+	    if (stripe->hdr_bytes < MIN_MSG_LENGTH) {
+		continue;
+	    }
+	    if (__start_chunk(rank, stripe) != MPI_SUCCESS) {
+		progress_close_connection(rank);
+		return MPI_ERR_OTHER;
+	    }
+	} else {
+	    nread = read_avail(stripe->fd, stripe->dst, stripe->dst_left);
+	    if (nread < 0) {
+		break;
+	    }
+	    stripe->dst += nread;
+	    stripe->dst_left -= nread;
+	}
+	if (stripe->recv_req && stripe->dst_left == 0) {
+	    __finish_chunk_recv(rank, stripe);
+	}
+    }
+
+    if (nread == MSG_AGAIN) {
+	return MPI_SUCCESS;
+    }
+    if (nread == MSG_CONN_CLOSED && !stripe->recv_req
+	&& stripe->hdr_bytes == 0) {
+	//peer has finished with this stream
+	epoll_ctl(commtab->epfd, EPOLL_CTL_DEL, stripe->fd, NULL);
+	close(stripe->fd);
+	stripe->fd = 0;
+	return MPI_SUCCESS;
+    }
+    dprintf("Failed to receive chunk from rank:%d stream:%d\n", rank, i);
+    progress_close_connection(rank);
+    return MPI_ERR_OTHER;
+}
+
+/*
+ * Handles event of an extra stream.
+ */
+static void __progress_stripe_event(uint32_t id, uint32_t events)
+{
+    int rank = id & STRIPE_RANK_MASK;
+    int i = (id & ~(STRIPE_EVENT | STRIPE_RX)) >> STRIPE_SHIFT;
+    struct connection *conn = &connections[rank];
+
+    if (id & STRIPE_RX) {
+	if (conn->rx_stripes && conn->rx_stripes[i].fd) {
+	    __progress_stripe_recv(rank, i);
+	}
+	return;
+    }
+    if (!conn->tx_stripes || !conn->tx_stripes[i].fd) {
+	return;
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) {
+	dprintf("Stream:%d to rank:%d failed\n", i, rank);
+	progress_close_connection(rank);
+    } else if (events & EPOLLOUT) {
+	__progress_stripe_send(rank, i);
+    }
+}
+
+/*
+ * Peer of a shared memory channel rang the doorbell or hung up.
+ */
+static int __progress_doorbell(int rank)
+{
+    struct connection *conn = &connections[rank];
+    int ret = shm_channel_doorbell(&commtab->ctable[rank]);
+
+    //whatever peer wrote before it hung up is still in the ring
+    if (__progress_recv(rank) != MPI_SUCCESS) {
+	return MPI_ERR_OTHER;
+    }
+    if (ret == MSG_SUCCESS) {
+	return conn->send_head ? __progress_send(rank) : MPI_SUCCESS;
+    }
+    if (ret == MSG_CONN_CLOSED && conn->recv_state == RECV_HDR
+	&& conn->hdr_bytes == 0) {
+	dprintf("Connection closed by rank:%d\n", rank);
+	progress_close_connection(rank);
+	return MPI_SUCCESS;
+    }
+    dprintf("Failed to receive message from rank:%d\n", rank);
+    progress_close_connection(rank);
+    return MPI_ERR_OTHER;
+}
+
+/*
+ * Moves every shared memory channel forward.
+ * Return value
+ *     TRUE if any bytes moved
+ */
+static int __progress_shm(void)
+{
+    struct context_table *entry;
+    uint64_t position;
+    int moved = FALSE;
+    int rank;
+    int i;
+
+    //closing a connection reorders the array, walk it backwards
+    for (i = nr_shm_ranks - 1; i >= 0; i--) {
+	rank = shm_ranks[i];
+	entry = &commtab->ctable[rank];
+	position = shm_channel_position(entry->shm);
+	__progress_recv(rank);
+	if (entry->fd && connections[rank].send_head) {
+	    __progress_send(rank);
+	}
+	if (!entry->fd || shm_channel_position(entry->shm) != position) {
+	    moved = TRUE;
+	}
+    }
+    return moved;
+}
+
+/*
+ * Asks peers of shared memory channels for a doorbell before sleeping.
+ * Return value
+ *     TRUE if a channel became ready meanwhile
+ */
+static int __arm_shm(void)
+{
+    int ready = FALSE;
+    int rank;
+    int i;
+
+    for (i = 0; i < nr_shm_ranks; i++) {
+	rank = shm_ranks[i];
+	if (shm_channel_arm(commtab->ctable[rank].shm,
+			    connections[rank].want_write)) {
+	    ready = TRUE;
+	}
+    }
+    return ready;
+}
+
+/*
+ * Advances schedules of outstanding collectives and completes the
+ * requests of finished ones.
+ */
+static void __progress_colls(void)
+{
+    MPI_Request *link = &active_colls;
+    MPI_Request req;
+
+    while ((req = *link) != NULL) {
+	if (!sched_advance(req->sched)) {
+	    link = &req->next;
+	    continue;
+	}
+	req->error = req->sched->error;
+	sched_free(req->sched);
+	req->sched = NULL;
+	req->complete = TRUE;
+	*link = req->next;
+	req->next = NULL;
+    }
+}
+
+int progress_isched(struct sched *sched, MPI_Request * request)
+{
+    MPI_Request *link;
+    MPI_Request req;
+    int ret = sched->error;
+
+    //schedule failed while it was built
+    if (ret != MPI_SUCCESS) {
+	sched_free(sched);
+	return ret;
+    }
+    req = __alloc_request(REQ_COLL);
+    if (!req) {
+	sched_free(sched);
+	return MPI_ERR_OTHER;
+    }
+    req->sched = sched;
+
+    //schedules are advanced in the order collectives were started
+    link = &active_colls;
+    while (*link) {
+	link = &(*link)->next;
+    }
+    *link = req;
+    __progress_colls();
+
+    *request = req;
+    return MPI_SUCCESS;
+}
+
+int progress_flush(void)
+{
+    int pending = TRUE;
+    int rank;
+
+    while (pending) {
+	__flush_batches(TRUE);
+	pending = FALSE;
+	for (rank = 0; rank < commtab->size; rank++) {
+	    if (commtab->ctable[rank].fd && connections[rank].send_head) {
+		pending = TRUE;
+		break;
+	    }
+	}
+	if (pending && progress_poll(-1) != MPI_SUCCESS) {
+	    return MPI_ERR_OTHER;
+	}
+    }
+    //batches which could not be flushed are lost
+    return nr_batch_ranks > 0 ? MPI_ERR_OTHER : MPI_SUCCESS;
+}
+
+/*
+ * Waits at most timeout milliseconds for events of connections. In spin
+ * progress mode a caller willing to wait polls for spin_time microseconds
+ * first, sweeping shared memory channels as well.
+ * Return value
+ *     number of events, 0 if there are none or shared memory moved, or -1
+ */
+static int __wait_events(struct epoll_event *events, int timeout)
+{
+    uint64_t deadline;
+    int nready;
+
+    if (timeout != 0 && spin_time > 0) {
+	deadline = __now_us() + spin_time;
+	do {
+	    nready = epoll_wait(commtab->epfd, events, MAX_EVENTS, 0);
+	    if (nready != 0 || (nr_shm_ranks > 0 && __progress_shm())) {
+		return nready;
+	    }
+	    //the peer may be waiting for this core to send the answer
+	    sched_yield();
+	} while (__now_us() < deadline);
+    }
+    //shared memory channels do not wake up epoll by themselves
+    if (nr_shm_ranks > 0 && timeout != 0 && __arm_shm()) {
+	timeout = 0;
+    }
+    return epoll_wait(commtab->epfd, events, MAX_EVENTS, timeout);
+}
+
+int progress_poll(int timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int nready;
+    int rank;
+    int i;
+
+    //batches go out before the caller sleeps or once they waited enough
+    if (nr_batch_ranks > 0) {
+	__flush_batches(timeout != 0);
+    }
+    if (nr_shm_ranks > 0 && __progress_shm()) {
+	timeout = 0;
+    }
+
+    nready = __wait_events(events, timeout);
+    if (nready < 0) {
+	if (errno == EINTR) {
+	    return MPI_SUCCESS;
+	}
+	dprintf("Failed to wait for connections\n");
+	return MPI_ERR_OTHER;
+    }
+
+    for (i = 0; i < nready; i++) {
+	if (events[i].data.u32 == LISTENER_ID) {
+	    __handle_new_connection();
+	    continue;
+	}
+	if (events[i].data.u32 & STRIPE_EVENT) {
+	    __progress_stripe_event(events[i].data.u32, events[i].events);
+	    continue;
+	}
+	//event identifies the rank of the peer
+	rank = events[i].data.u32;
+	if (commtab->ctable[rank].shm) {
+	    if (commtab->ctable[rank].fd) {
+		__progress_doorbell(rank);
+	    }
+	    continue;
+	}
+	if (commtab->ctable[rank].fd
+	    && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+	    __progress_recv(rank);
+	}
+	if (commtab->ctable[rank].fd && (events[i].events & EPOLLOUT)) {
+	    __progress_send(rank);
+	}
+    }
+
+    if (active_colls) {
+	__progress_colls();
+    }
+    return MPI_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/**
+ * This header defines the progress engine of the library.
+ *
+ * The progress engine owns the non-blocking connections of the
+ * communicator. Every connection has a queue of outstanding send requests
+ * and a receive state machine, both of which remember how much of the
+ * current message was transferred, so partial messages are carried over
+ * from one call into the library to the next.
+ *
+ * Payload of a large message may also be striped over several extra TCP
+ * streams to the peer, which the sender opens on first use. Chunks are
+ * written to the streams in turn, so several congestion windows carry the
+ * message at once, and the receiver places every chunk by its offset.
+ */
+#ifndef __MY_PROGRESS_H
+#define __MY_PROGRESS_H
+
+#include "mympi.h"
+#include "mymsg.h"
+#include "mymatch.h"
+#include "mysched.h"
+
+#include <sys/uio.h>
+
+/*Progress engine event identifier of the listening server, connection
+ *events are identified by the rank of the peer*/
+#define LISTENER_ID          ((uint32_t) -1)
+
+/*Communicator table defined in mympi.c*/
+extern struct _MPI_Comm *commtab;
+
+/*Request kinds*/
+#define REQ_SEND             1
+#define REQ_RECV             2
+#define REQ_CTRL             3	/*internal protocol message */
+#define REQ_COLL             4	/*non-blocking collective */
+#define REQ_CHUNK            5	/*chunk of a striped large send */
+
+/*Rendezvous states of a send request*/
+#define RNDV_NONE            0	/*eager send */
+#define RNDV_RTS             1	/*request to send is being written */
+#define RNDV_WAIT_CTS        2	/*waiting for receiver to match it */
+#define RNDV_DATA            3	/*payload is being written */
+
+/*Point to point request*/
+struct _MPI_Request {
+    int kind;			/*REQ_SEND, REQ_RECV or REQ_COLL */
+    int peer;			/*destination rank of send */
+    int complete;		/*set once request is finished */
+    int error;			/*return value of the operation */
+    MPI_Status status;		/*status of completed receive */
+
+    /*send request */
+    msg_t hdr;			/*header of the message being sent */
+    struct iovec iov[2];	/*header and payload vectors */
+    struct iovec *iov_next;	/*first vector not completely written */
+    int iovcnt;			/*number of vectors left */
+    int rndv_state;		/*rendezvous state of large send */
+    unsigned int rndv_id;	/*sender id of rendezvous message */
+    unsigned int chunks_left;	/*chunks of striped send not written yet */
+    struct _MPI_Request *parent;	/*send request of a chunk */
+
+    /*receive request */
+    void *buff;			/*user buffer */
+    unsigned int capacity;	/*size of user buffer in bytes */
+    struct posted_recv posted;	/*entry in posted receive queue */
+    unsigned int rndv_left;	/*striped payload bytes not received yet */
+
+    /*collective request */
+    struct sched *sched;	/*schedule being run */
+
+    struct _MPI_Request *next;	/*send queue or free list link */
+};
+
+/*
+ * This function allocates progress engine state for all the connections
+ * of the communicator.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_init(void);
+
+/*
+ * This function releases progress engine state.
+ */
+void progress_finalize(void);
+
+/*
+ * This function switches an established connection to non-blocking mode
+ * and hands it to the progress engine. Connection must not be used with
+ * blocking message functions afterwards.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_add_connection(int /*rank */ , int /*fd */ );
+
+/*
+ * This function hands an extra stream opened by a peer for striped
+ * messages to the progress engine.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_add_stripe(int /*rank */ , int /*stripe */ , int /*fd */ );
+
+/*
+ * This function closes connection to a peer together with its extra
+ * streams. Requests still queued on it, and receives posted for this
+ * peer as source, complete with MPI_ERR_OTHER.
+ */
+void progress_close_connection(int /*rank */ );
+
+/*
+ * This function adds the listening server to the progress engine.
+ */
+int progress_watch_listener(int /*fd */ );
+
+/*
+ * This function starts sending a data message to a connected peer.
+ * Messages larger than the eager limit are announced first and their
+ * payload is sent only once the receiver has matched them. Messages to
+ * this processor itself are delivered locally and complete at once.
+ * Input parameters
+ *      buff      payload
+ *      length    payload length in bytes
+ *      datatype  datatype of message
+ *      peer      destination rank
+ *      tag       message tag
+ * Output parameters
+ *      request   send request
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_isend(void * /*buff */ , unsigned int /*length */ ,
+		   MPI_Datatype /*datatype */ , int /*peer */ , int /*tag */ ,
+		   MPI_Request * /*request */ );
+
+/*
+ * This function starts receiving a message from source with tag into
+ * buffer of capacity bytes.
+ * Output parameters
+ *      request   receive request
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_irecv(void * /*buff */ , unsigned int /*capacity */ ,
+		   int /*source */ , int /*tag */ ,
+		   MPI_Request * /*request */ );
+
+/*
+ * This function starts running the schedule of a collective operation,
+ * which the request owns from now on.
+ * Output parameters
+ *      request   collective request
+ * Return value
+ *     MPI_SUCCESS on success or else the error of the schedule
+ */
+int progress_isched(struct sched * /*sched */ , MPI_Request * /*request */ );
+
+/*
+ * This function moves outstanding requests forward. It waits at most
+ * timeout milliseconds for a connection to become ready, -1 waits till
+ * something happens and 0 only handles what is ready right now. In spin
+ * progress mode a caller willing to wait polls for a while before it
+ * sleeps. Schedules of outstanding collectives are advanced afterwards.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_poll(int /*timeout */ );
+
+/*
+ * This function writes out coalesced messages and everything else still
+ * queued for sending, so connections may be closed afterwards.
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int progress_flush(void);
+
+/*
+ * This function releases a request.
+ */
+void progress_free_request(MPI_Request /*request */ );
+
+/*
+ * This function accepts a pending connection on the listening server.
+ * It is implemented by connection management in mympi.c.
+ */
+int __handle_new_connection(void);
+
+/*
+ * This function opens extra stream number stripe to a connected peer. It
+ * is implemented by connection management in mympi.c.
+ * Output parameters
+ *      fd        connected descriptor
+ * Return value
+ *     MPI_SUCCESS on success or else MPI_ERR_OTHER
+ */
+int __connect_stripe(int /*peer */ , int /*stripe */ , int * /*fd */ );
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * Implementation of collective schedules.
+ */
+#include "mysched.h"
+#include "myprogress.h"
+#include "mycoll.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*Define boolean values*/
+#define FALSE              0
+#define TRUE               1
+
+/*Steps allocated for a new schedule, doubled when it fills up*/
+#define SCHED_INITIAL_STEPS 16
+
+struct sched *sched_create(void)
+{
+    struct sched *sched = (struct sched *) malloc(sizeof(struct sched));
+
+    if (!sched) {
+	dprintf("Failed to allocate schedule\n");
+	return NULL;
+    }
+    memset(sched, 0, sizeof(struct sched));
+    return sched;
+}
+
+void sched_free(struct sched *sched)
+{
+    if (sched) {
+	free(sched->steps);
+	free(sched->scratch);
+	free(sched);
+    }
+}
+
+void *sched_scratch(struct sched *sched, size_t length)
+{
+    sched->scratch = malloc(length);
+    if (!sched->scratch && length > 0) {
+	dprintf("Failed to allocate schedule scratch\n");
+	sched->error = MPI_ERR_OTHER;
+    }
+    return sched->scratch;
+}
+
+/*
+ * Appends a cleared step of kind and returns it, or NULL with schedule
+ * failed.
+ */
+static struct sched_step *__append(struct sched *sched, int kind)
+{
+    struct sched_step *steps;
+    struct sched_step *step;
+    int capacity;
+
+    if (sched->nr_steps == sched->capacity) {
+	capacity = sched->capacity ? sched->capacity * 2 : SCHED_INITIAL_STEPS;
+	steps = (struct sched_step *)
+	    realloc(sched->steps, sizeof(struct sched_step) * capacity);
+	if (!steps) {
+	    dprintf("Failed to grow schedule to %d steps\n", capacity);
+	    sched->error = MPI_ERR_OTHER;
+	    return NULL;
+	}
+	sched->steps = steps;
+	sched->capacity = capacity;
+    }
+    step = &sched->steps[sched->nr_steps++];
+    memset(step, 0, sizeof(struct sched_step));
+    step->kind = kind;
+    return step;
+}
+
+int sched_send(struct sched *sched, void *buff, unsigned int length,
+	       int peer, int tag)
+{
+    struct sched_step *step = __append(sched, SCHED_SEND);
+
+    if (!step) {
+	return -1;
+    }
+    step->buff = buff;
+    step->length = length;
+    step->peer = peer;
+    step->tag = tag;
+    return sched->nr_steps - 1;
+}
+
+int sched_recv(struct sched *sched, void *buff, unsigned int length,
+	       int peer, int tag)
+{
+    struct sched_step *step = __append(sched, SCHED_RECV);
+
+    if (!step) {
+	return -1;
+    }
+    step->buff = buff;
+    step->length = length;
+    step->peer = peer;
+    step->tag = tag;
+    return sched->nr_steps - 1;
+}
+
+int sched_reduce(struct sched *sched, void *inout, const void *in,
+		 unsigned int count, op_kernel_t kernel)
+{
+    struct sched_step *step = __append(sched, SCHED_REDUCE);
+
+    if (!step) {
+	return -1;
+    }
+    step->buff = inout;
+    step->src = in;
+    step->length = count;
+    step->kernel = kernel;
+    return sched->nr_steps - 1;
+}
+
+int sched_copy(struct sched *sched, void *dst, const void *src,
+	       unsigned int length)
+{
+    struct sched_step *step = __append(sched, SCHED_COPY);
+
+    if (!step) {
+	return -1;
+    }
+    step->buff = dst;
+    step->src = src;
+    step->length = length;
+    return sched->nr_steps - 1;
+}
+
+int sched_wait(struct sched *sched, int dep)
+{
+    struct sched_step *step = __append(sched, SCHED_WAIT);
+
+    if (!step) {
+	return -1;
+    }
+    step->dep = dep;
+    return sched->nr_steps - 1;
+}
+
+int sched_fence(struct sched *sched)
+{
+    return __append(sched, SCHED_FENCE) ? sched->nr_steps - 1 : -1;
+}
+
+/*
+ * Tells whether a step is complete, collecting its request if it has
+ * just finished.
+ */
+static int __test_step(struct sched *sched, struct sched_step *step)
+{
+    if (step->complete) {
+	return TRUE;
+    }
+    if (!step->request || !step->request->complete) {
+	return FALSE;
+    }
+    if (step->request->error != MPI_SUCCESS && sched->error == MPI_SUCCESS) {
+	sched->error = step->request->error;
+    }
+    progress_free_request(step->request);
+    step->request = NULL;
+    step->complete = TRUE;
+    return TRUE;
+}
+
+/*
+ * Tells whether all the steps before end are complete.
+ */
+static int __test_steps(struct sched *sched, int end)
+{
+    while (sched->done < end) {
+	if (!__test_step(sched, &sched->steps[sched->done])) {
+	    return FALSE;
+	}
+	sched->done++;
+    }
+    return TRUE;
+}
+
+/*
+ * Starts a step, returns FALSE if it has to wait.
+ */
+static int __start_step(struct sched *sched, struct sched_step *step)
+{
+    int ret = MPI_SUCCESS;
+
+    switch (step->kind) {
+    case SCHED_SEND:
+	ret = __coll_isend(step->buff, step->length, step->peer, step->tag,
+			   &step->request);
+	break;
+    case SCHED_RECV:
+	ret = __coll_irecv(step->buff, step->length, step->peer, step->tag,
+			   &step->request);
+	break;
+    case SCHED_REDUCE:
+	step->kernel(step->buff, step->src, step->length);
+	step->complete = TRUE;
+	break;
+    case SCHED_COPY:
+	memcpy(step->buff, step->src, step->length);
+	step->complete = TRUE;
+	break;
+    case SCHED_WAIT:
+	if (!__test_step(sched, &sched->steps[step->dep])) {
+	    return FALSE;
+	}
+	step->complete = TRUE;
+	break;
+    case SCHED_FENCE:
+	if (!__test_steps(sched, step - sched->steps)) {
+	    return FALSE;
+	}
+	step->complete = TRUE;
+	break;
+    }
+
+    if (ret != MPI_SUCCESS) {
+	dprintf("Failed to start schedule step to rank:%d\n", step->peer);
+	sched->error = ret;
+	step->complete = TRUE;
+    }
+    return TRUE;
+}
+
+/*
+ * Skips the steps not started yet of a failed schedule.
+ */
+static void __abort(struct sched *sched)
+{
+    while (sched->next < sched->nr_steps) {
+	sched->steps[sched->next++].complete = TRUE;
+    }
+}
+
+int sched_advance(struct sched *sched)
+{
+    //a failed schedule only waits for steps in flight
+    while (sched->error == MPI_SUCCESS && sched->next < sched->nr_steps) {
+	if (!__start_step(sched, &sched->steps[sched->next])) {
+	    return FALSE;
+	}
+	sched->next++;
+    }
+    if (sched->error != MPI_SUCCESS) {
+	__abort(sched);
+    }
+    return __test_steps(sched, sched->nr_steps);
+}
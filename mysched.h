@@ -0,0 +1,101 @@
+/**
+ * This header defines schedules of collective operations.
+ *
+ * A collective is compiled into a schedule, a list of steps which send,
+ * receive, combine or copy buffers. Steps are started in order without
+ * waiting for the earlier ones unless told to: a wait step holds the
+ * schedule till one given step is complete and a fence till all the steps
+ * before it are. The progress engine advances schedules of outstanding
+ * collectives whenever it is polled, so they move forward in the
+ * background of MPI_Test and MPI_Wait like point-to-point requests do.
+ */
+#ifndef __MY_SCHED_H
+#define __MY_SCHED_H
+
+#include "mympi.h"
+#include "myop.h"
+
+#include <stddef.h>
+
+/*Schedule step kinds*/
+#define SCHED_SEND           1	/*send length bytes of buff to peer */
+#define SCHED_RECV           2	/*receive length bytes into buff */
+#define SCHED_REDUCE         3	/*combine length elements of src into buff */
+#define SCHED_COPY           4	/*copy length bytes of src to buff */
+#define SCHED_WAIT           5	/*wait till step dep is complete */
+#define SCHED_FENCE          6	/*wait till all earlier steps are complete */
+
+/*Schedule step*/
+struct sched_step {
+    int kind;			/*one of SCHED_* */
+    void *buff;			/*buffer sent, received or written */
+    const void *src;		/*buffer combined or copied */
+    unsigned int length;	/*bytes, elements for SCHED_REDUCE */
+    int peer;			/*rank sent to or received from */
+    int tag;			/*message tag */
+    op_kernel_t kernel;		/*reduction kernel */
+    int dep;			/*step waited for */
+    MPI_Request request;	/*send or receive in flight */
+    int complete;		/*set once step is finished */
+};
+
+/*Schedule of a collective operation*/
+struct sched {
+    struct sched_step *steps;	/*steps in order */
+    int nr_steps;
+    int capacity;		/*allocated steps */
+    int next;			/*first step not started */
+    int done;			/*steps before it are all complete */
+    int error;			/*first error of a step */
+    void *scratch;		/*buffer released with schedule */
+};
+
+/*
+ * This function allocates an empty schedule.
+ * Return value
+ *     schedule or NULL if out of memory
+ */
+struct sched *sched_create(void);
+
+/*
+ * This function releases a schedule. Steps still in flight are abandoned.
+ */
+void sched_free(struct sched * /*sched */ );
+
+/*
+ * This function allocates scratch memory of length bytes which lives as
+ * long as the schedule. It may be called once per schedule.
+ * Return value
+ *     scratch memory or NULL if out of memory
+ */
+void *sched_scratch(struct sched * /*sched */ , size_t /*length */ );
+
+/*
+ * These functions append a step to a schedule. A step which cannot be
+ * appended makes the whole schedule fail with MPI_ERR_OTHER, so builders
+ * need to check the error of the schedule only once at the end.
+ * Return value
+ *     index of the step, to be waited for with sched_wait, or -1
+ */
+int sched_send(struct sched * /*sched */ , void * /*buff */ ,
+	       unsigned int /*length */ , int /*peer */ , int /*tag */ );
+int sched_recv(struct sched * /*sched */ , void * /*buff */ ,
+	       unsigned int /*length */ , int /*peer */ , int /*tag */ );
+int sched_reduce(struct sched * /*sched */ , void * /*inout */ ,
+		 const void * /*in */ , unsigned int /*count */ ,
+		 op_kernel_t /*kernel */ );
+int sched_copy(struct sched * /*sched */ , void * /*dst */ ,
+	       const void * /*src */ , unsigned int /*length */ );
+int sched_wait(struct sched * /*sched */ , int /*step */ );
+int sched_fence(struct sched * /*sched */ );
+
+/*
+ * This function starts every step of a schedule it can without blocking.
+ * An error stops the schedule from starting new steps, it still finishes
+ * once the steps in flight are complete.
+ * Return value
+ *     TRUE once all the steps are complete, FALSE otherwise
+ */
+int sched_advance(struct sched * /*sched */ );
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * Implementation of the shared memory transport.
+ *
+ * Each ring is written by exactly one processor and read by exactly one,
+ * so positions are plain counters which only their owner advances: head
+ * by the producer and tail by the consumer, published with release stores
+ * and read with acquire loads. Counters and flags live on cache lines of
+ * their own so that the two sides do not keep stealing each other's line.
+ */
+#include "myshm.h"
+#include "mymsg.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+/*Define boolean values*/
+#define FALSE              0
+#define TRUE               1
+
+/*Cache line size used to lay out shared counters*/
+#define SHM_CACHE_LINE     64
+#define __cacheline_aligned __attribute__ ((aligned(SHM_CACHE_LINE)))
+
+/*Maximum length of segment name*/
+#define SHM_NAME_LENGTH    64
+
+/*Single producer single consumer ring*/
+struct shm_ring {
+    uint64_t head __cacheline_aligned;	/*bytes produced */
+    uint64_t tail __cacheline_aligned;	/*bytes consumed */
+    uint32_t reader_waiting __cacheline_aligned;	/*ring on new data */
+    uint32_t writer_waiting __cacheline_aligned;	/*ring on free space */
+    char data[SHM_RING_SIZE] __cacheline_aligned;
+};
+
+/*Shared segment, ring 0 carries data from the creator to the peer*/
+struct shm_segment {
+    struct shm_ring ring[2];
+};
+
+/*Mapping of a segment by one of the processors*/
+struct shm_channel {
+    struct shm_segment *segment;
+    struct shm_ring *tx;	/*ring this processor produces into */
+    struct shm_ring *rx;	/*ring this processor consumes from */
+};
+
+int shm_enabled(void)
+{
+    char *enable = getenv(SHM_ENABLE_ENV);
+
+    return !enable || strcmp(enable, "0") != 0;
+}
+
+/*
+ * Builds name of a segment.
+ */
+static void __shm_name(char *name, uint16_t port, int rank)
+{
+    snprintf(name, SHM_NAME_LENGTH, "/mympi-%u-%d", port, rank);
+}
+
+/*
+ * Maps segment and hands out a channel for one of its sides.
+ */
+static int __shm_map(int fd, int creator, struct shm_channel **channel)
+{
+    struct shm_channel *ch;
+    void *addr;
+
+    ch = (struct shm_channel *) malloc(sizeof(struct shm_channel));
+    if (!ch) {
+	return MSG_ERROR;
+    }
+    //fault the rings in now rather than on the first pass of messages
+    addr = mmap(NULL, sizeof(struct shm_segment), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (addr == MAP_FAILED) {
+	dprintf("Failed to map shared memory segment\n");
+	free(ch);
+	return MSG_ERROR;
+    }
+    ch->segment = (struct shm_segment *) addr;
+    ch->tx = &ch->segment->ring[creator ? 0 : 1];
+    ch->rx = &ch->segment->ring[creator ? 1 : 0];
+
+    *channel = ch;
+    return MSG_SUCCESS;
+}
+
+int shm_channel_create(uint16_t port, int rank,
+		       struct shm_channel **channel)
+{
+    char name[SHM_NAME_LENGTH];
+    int fd;
+    int ret;
+
+    __shm_name(name, port, rank);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0 && errno == EEXIST) {
+	//left behind by a processor which died during handshake
+	shm_unlink(name);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    }
+    if (fd < 0) {
+	dprintf("Failed to create shared memory segment:%s\n", name);
+	return MSG_ERROR;
+    }
+    //new segment is zero filled, rings start out empty
+    if (ftruncate(fd, sizeof(struct shm_segment)) < 0) {
+	dprintf("Failed to size shared memory segment:%s\n", name);
+	close(fd);
+	shm_unlink(name);
+	return MSG_ERROR;
+    }
+    ret = __shm_map(fd, TRUE, channel);
+    close(fd);
+    if (ret != MSG_SUCCESS) {
+	shm_unlink(name);
+    }
+    return ret;
+}
+
+int shm_channel_attach(uint16_t port, int rank,
+		       struct shm_channel **channel)
+{
+    char name[SHM_NAME_LENGTH];
+    struct stat st;
+    int fd;
+    int ret;
+
+    __shm_name(name, port, rank);
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+	dprintf("Failed to open shared memory segment:%s\n", name);
+	return MSG_ERROR;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(struct shm_segment)) {
+	dprintf("Unexpected size of shared memory segment:%s\n", name);
+	close(fd);
+	return MSG_ERROR;
+    }
+    ret = __shm_map(fd, FALSE, channel);
+    close(fd);
+    return ret;
+}
+
+void shm_channel_unlink(uint16_t port, int rank)
+{
+    char name[SHM_NAME_LENGTH];
+
+    __shm_name(name, port, rank);
+    shm_unlink(name);
+}
+
+void shm_channel_destroy(struct shm_channel *channel)
+{
+    if (channel) {
+	munmap(channel->segment, sizeof(struct shm_segment));
+	free(channel);
+    }
+}
+
+/*
+ * Rings the doorbell if the peer asked for it. Fence orders the position
+ * just published before the flag is looked at, pairing with the fence in
+ * shm_channel_arm, so either the peer sees the new position or we see its
+ * flag.
+ */
+static void __shm_notify(struct context_table *entry, uint32_t * waiting)
+{
+    char bell = 0;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED)
+	&& __atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL)) {
+	//a full socket already holds a wake up
+	send(entry->fd, &bell, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+}
+
+int shm_channel_arm(struct shm_channel *channel, int want_write)
+{
+    struct shm_ring *rx = channel->rx;
+    struct shm_ring *tx = channel->tx;
+
+    __atomic_store_n(&rx->reader_waiting, 1, __ATOMIC_RELAXED);
+    if (want_write) {
+	__atomic_store_n(&tx->writer_waiting, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&rx->head, __ATOMIC_ACQUIRE) != rx->tail) {
+	return TRUE;
+    }
+    if (want_write
+	&& tx->head - __atomic_load_n(&tx->tail, __ATOMIC_ACQUIRE) <
+	SHM_RING_SIZE) {
+	return TRUE;
+    }
+    return FALSE;
+}
+
+uint64_t shm_channel_position(struct shm_channel *channel)
+{
+    return channel->tx->head + channel->rx->tail;
+}
+
+int shm_channel_doorbell(struct context_table *entry)
+{
+    char bells[64];
+    int nread;
+
+    while ((nread = read_avail(entry->fd, bells, sizeof(bells))) > 0);
+
+    return nread == MSG_AGAIN ? MSG_SUCCESS : nread;
+}
+
+static int __shm_write_iov(struct context_table *entry, struct iovec **iov,
+			   int *iovcnt)
+{
+    struct shm_ring *ring = entry->shm->tx;
+    uint64_t head = ring->head;
+    uint64_t space =
+	SHM_RING_SIZE - (head - __atomic_load_n(&ring->tail,
+						__ATOMIC_ACQUIRE));
+    unsigned int offset;
+    unsigned int first;
+    size_t n;
+
+    while (*iovcnt > 0) {
+	if ((*iov)->iov_len == 0) {
+	    (*iov)++;
+	    (*iovcnt)--;
+	    continue;
+	}
+	if (space == 0) {
+	    break;
+	}
+	n = (*iov)->iov_len < space ? (*iov)->iov_len : space;
+
+	//copy in at most two pieces around the end of the ring
+	offset = head & (SHM_RING_SIZE - 1);
+	first = SHM_RING_SIZE - offset < n ? SHM_RING_SIZE - offset : n;
+	memcpy(ring->data + offset, (*iov)->iov_base, first);
+	memcpy(ring->data, (char *) (*iov)->iov_base + first, n - first);
+
+	head += n;
+	space -= n;
+	(*iov)->iov_base = (char *) (*iov)->iov_base + n;
+	(*iov)->iov_len -= n;
+    }
+
+    if (head != ring->head) {
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+	__shm_notify(entry, &ring->reader_waiting);
+    }
+    return *iovcnt > 0 ? MSG_AGAIN : MSG_SUCCESS;
+}
+
+static int __shm_read_avail(struct context_table *entry, void *buffer,
+			    unsigned int n)
+{
+    struct shm_ring *ring = entry->shm->rx;
+    uint64_t tail = ring->tail;
+    uint64_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    unsigned int offset;
+    unsigned int first;
+
+    if (n == 0) {
+	return 0;
+    }
+    if (avail == 0) {
+	return MSG_AGAIN;
+    }
+    if (avail < n) {
+	n = avail;
+    }
+    //copy out in at most two pieces around the end of the ring
+    offset = tail & (SHM_RING_SIZE - 1);
+    first = SHM_RING_SIZE - offset < n ? SHM_RING_SIZE - offset : n;
+    memcpy(buffer, ring->data + offset, first);
+    memcpy((char *) buffer + first, ring->data, n - first);
+
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    __shm_notify(entry, &ring->writer_waiting);
+    return n;
+}
+
+static void __shm_close(struct context_table *entry)
+{
+    shm_channel_destroy(entry->shm);
+    entry->shm = NULL;
+}
+
+const struct transport shm_transport = {
+    "shm",
+    __shm_write_iov,
+    __shm_read_avail,
+    __shm_close
+};
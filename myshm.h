@@ -0,0 +1,90 @@
+/**
+ * This header defines the shared memory transport.
+ *
+ * Processors on the same host exchange messages through a POSIX shared
+ * memory segment holding one lock-free single producer single consumer
+ * ring per direction. The TCP connection between them stays open and is
+ * used only as a doorbell: a byte is written to it when the other side
+ * sleeps in the progress engine and has something new to do. Closing it
+ * still tells the peer that this processor has finished.
+ *
+ * The processor opening the connection creates the segment and offers it
+ * in its MSG_INIT message, the peer maps it and accepts it in its reply.
+ */
+#ifndef __MY_SHM_H
+#define __MY_SHM_H
+
+#include "mytransport.h"
+
+#include <stdint.h>
+
+/*Size of each ring in bytes, power of two*/
+#define SHM_RING_SIZE      (1 << 20)
+
+/*Environment variable which disables shared memory transport when 0*/
+#define SHM_ENABLE_ENV     "MYMPI_SHM"
+
+/*Mapped segment of a connection, see myshm.c*/
+struct shm_channel;
+
+/*Transport over shared memory channel*/
+extern const struct transport shm_transport;
+
+/*
+ * This function tells whether shared memory transport may be used.
+ */
+int shm_enabled(void);
+
+/*
+ * This function creates and maps segment offered to a peer. Segment is
+ * named after the server port of the peer and rank of this processor.
+ * Return value
+ *     MSG_SUCCESS on success or else MSG_ERROR
+ */
+int shm_channel_create(uint16_t /*port */ , int /*rank */ ,
+		       struct shm_channel ** /*channel */ );
+
+/*
+ * This function maps segment offered by processor of rank to this
+ * processor listening on port.
+ * Return value
+ *     MSG_SUCCESS on success or else MSG_ERROR
+ */
+int shm_channel_attach(uint16_t /*port */ , int /*rank */ ,
+		       struct shm_channel ** /*channel */ );
+
+/*
+ * This function removes name of a segment once the handshake is over.
+ * Mappings stay valid till they are destroyed.
+ */
+void shm_channel_unlink(uint16_t /*port */ , int /*rank */ );
+
+/*
+ * This function unmaps segment.
+ */
+void shm_channel_destroy(struct shm_channel * /*channel */ );
+
+/*
+ * This function asks peer to ring the doorbell on new data and, if
+ * want_write is set, on free space, before the progress engine sleeps.
+ * Return value
+ *     TRUE if channel can make progress right away and sleeping would
+ *     miss it, FALSE otherwise
+ */
+int shm_channel_arm(struct shm_channel * /*channel */ , int /*want_write */ );
+
+/*
+ * This function returns a value which changes whenever this processor
+ * moves bytes through the channel.
+ */
+uint64_t shm_channel_position(struct shm_channel * /*channel */ );
+
+/*
+ * This function drains doorbell bytes from connection descriptor.
+ * Return value
+ *     MSG_SUCCESS, MSG_CONN_CLOSED once the peer has closed it or
+ *     MSG_ERROR
+ */
+int shm_channel_doorbell(struct context_table * /*entry */ );
+
+#endif
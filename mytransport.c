@@ -0,0 +1,28 @@
+/**
+ * Implementation of TCP transport.
+ */
+#include "mytransport.h"
+#include "mymsg.h"
+
+static int __tcp_write_iov(struct context_table *entry, struct iovec **iov,
+			   int *iovcnt)
+{
+    return write_iov(entry->fd, iov, iovcnt);
+}
+
+static int __tcp_read_avail(struct context_table *entry, void *buffer,
+			    unsigned int n)
+{
+    return read_avail(entry->fd, buffer, n);
+}
+
+static void __tcp_close(struct context_table *entry)
+{
+}
+
+const struct transport tcp_transport = {
+    "tcp",
+    __tcp_write_iov,
+    __tcp_read_avail,
+    __tcp_close
+};
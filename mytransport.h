@@ -0,0 +1,48 @@
+/**
+ * This header defines the transport interface of connections.
+ *
+ * Progress engine moves messages as a byte stream and does not care how
+ * the bytes travel. Every context table entry points to the transport of
+ * its connection, which is TCP by default and shared memory for peers on
+ * the same host (see myshm.h).
+ */
+#ifndef __MY_TRANSPORT_H
+#define __MY_TRANSPORT_H
+
+#include "mympi.h"
+
+#include <sys/uio.h>
+
+struct transport {
+    const char *name;
+
+    /*
+     * Writes as much of the scatter/gather vector as the connection takes
+     * and advances it past the written bytes.
+     * Return value
+     *     MSG_SUCCESS if everything is written, MSG_AGAIN if the connection
+     *     is full or else MSG_ERROR
+     */
+    int (*write_iov) (struct context_table * /*entry */ ,
+		      struct iovec ** /*iov */ , int * /*iovcnt */ );
+
+    /*
+     * Reads at most n bytes which are available right now.
+     * Return value
+     *     number of bytes read, MSG_AGAIN if nothing is available,
+     *     MSG_CONN_CLOSED or MSG_ERROR
+     */
+    int (*read_avail) (struct context_table * /*entry */ ,
+		       void * /*buffer */ , unsigned int /*n */ );
+
+    /*
+     * Releases transport state of the connection. Descriptor is closed by
+     * the caller.
+     */
+    void (*close) (struct context_table * /*entry */ );
+};
+
+/*Transport over the connection descriptor*/
+extern const struct transport tcp_transport;
+
+#endif
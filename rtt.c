@@ -1,6 +1,8 @@
 /**
  * This program benchmarks latency in communication component of MPI for various message sizes
- * and node topology.
+ * and node topology. For every message size it prints min, avg and max rtt and the bandwidth
+ * in MB/s derived from avg rtt to each node, so runs with different MYMPI_STREAMS settings show
+ * how striping of large messages scales.
  */
 #include "mympi.h"
 #include <stdio.h>
@@ -10,7 +12,7 @@
 
 #define NR_RTT_ITR 8
 #define MSG_START_EXP  3
-#define MSG_END_EXP 22
+#define MSG_END_EXP 24
 #define DEBUG 0
 
 int main(int argc, char *argv[])
@@ -149,8 +151,10 @@ int main(int argc, char *argv[])
 	    fprintf(stderr, "%-7d ", curr_msg_size);
 	    int i = 1;
 	    for (; i < nr_nodes; i++) {
-		fprintf(stderr, "%e %e %e ", stats[i * 3 + 0],
-			stats[i * 3 + 1], stats[i * 3 + 2]);
+		//message travels there and back in one rtt
+		fprintf(stderr, "%e %e %e %.1f ", stats[i * 3 + 0],
+			stats[i * 3 + 1], stats[i * 3 + 2],
+			2.0 * curr_msg_size / stats[i * 3 + 1] / 1e6);
 	    }
 	    fprintf(stderr, "\n");
 